@@ -0,0 +1,240 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <mutex>
+
+#include "column.h"
+
+namespace tv {
+
+thread_local uint32_t column_epoch = 1;
+
+// Owned chunks are pages of a power of two size carved out of large
+// slabs and recycled through per-size free lists, so importing never
+// goes back to malloc for more than one slab in a while, and a trace
+// closed and reopened reuses the pages of the old one. Slabs are never
+// returned to the system.
+#define PAGE_MIN_SHIFT 6
+#define PAGE_MAX_SHIFT 24
+#define PAGE_SLAB_SIZE (16 << 20)
+
+struct PagePool {
+    std::mutex lock;
+    std::vector<uint8_t*> pages[PAGE_MAX_SHIFT + 1]; // free pages by size
+    uint8_t* slab;
+    size_t slab_left;
+
+    PagePool() : slab(nullptr), slab_left(0) {}
+
+    static uint32_t page_shift(size_t size) {
+        uint32_t shift = 64 - __builtin_clzll(size - 1);
+        return std::max(shift, (uint32_t) PAGE_MIN_SHIFT);
+    }
+
+    uint8_t* alloc(size_t size) {
+        uint32_t shift = page_shift(size);
+        if (shift > PAGE_MAX_SHIFT) {
+            return (uint8_t*) malloc(size);
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        if (!pages[shift].empty()) {
+            uint8_t* page = pages[shift].back();
+            pages[shift].pop_back();
+            return page;
+        }
+        size_t psize = 1ULL << shift;
+        if (slab_left < psize) {
+            // keep the tail of the old slab as smaller pages
+            while (slab_left >= (1ULL << PAGE_MIN_SHIFT)) {
+                uint32_t s = 63 - __builtin_clzll(slab_left);
+                pages[s].push_back(slab);
+                slab += 1ULL << s;
+                slab_left -= 1ULL << s;
+            }
+            slab = (uint8_t*) malloc(PAGE_SLAB_SIZE);
+            slab_left = PAGE_SLAB_SIZE;
+        }
+        uint8_t* page = slab;
+        slab += psize;
+        slab_left -= psize;
+        return page;
+    }
+
+    void release(uint8_t* page, size_t size) {
+        uint32_t shift = page_shift(size);
+        if (shift > PAGE_MAX_SHIFT) {
+            free(page);
+            return;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        pages[shift].push_back(page);
+    }
+};
+
+// never destroyed, columns in static objects may outlive it otherwise
+static PagePool& page_pool = *new PagePool;
+
+// Readers may be walking the current directory, so a full one is
+// copied into a new one twice the size rather than realloc'd, and the
+// old one is kept until clear().
+void ColumnBase::add_chunk(const ColumnChunk& c) {
+    ColumnChunk* dir = chunks.load(std::memory_order_relaxed);
+    if (nchunks == maxchunks) {
+        maxchunks = maxchunks ? (maxchunks * 2) : 8;
+        ColumnChunk* ndir = (ColumnChunk*) malloc(maxchunks * sizeof(ColumnChunk));
+        if (nchunks) {
+            memcpy(ndir, dir, nchunks * sizeof(ColumnChunk));
+            retired.push_back(dir);
+        }
+        dir = ndir;
+    }
+    dir[nchunks++] = c;
+    chunks.store(dir, std::memory_order_release);
+}
+
+void ColumnBase::append_chunk(uint32_t n, uint32_t key) {
+    ColumnChunk c;
+    c.first = filled;
+    c.count = n;
+    c.capacity = 0;
+    c.data = nullptr;
+    c.epoch = 0;
+    c.key = key;
+    add_chunk(c);
+    filled += n;
+    publish();
+}
+
+void ColumnBase::clear(void) {
+    ColumnChunk* dir = chunks.load(std::memory_order_relaxed);
+    for (uint32_t n = 0; n < nchunks; n++) {
+        // paged chunks not loaded, or added before the pager was set
+        if (dir[n].data == nullptr) {
+            continue;
+        }
+        if ((pager != nullptr) || ((n == 0) && base)) {
+            free(dir[n].data);
+        } else {
+            page_pool.release(dir[n].data, ((size_t) dir[n].capacity) * elsize);
+        }
+    }
+    free(dir);
+    for (ColumnChunk* old : retired) {
+        free(old);
+    }
+    retired.clear();
+    chunks.store(nullptr, std::memory_order_relaxed);
+    nchunks = maxchunks = 0;
+    filled = 0;
+    base = 0;
+    count.store(0, std::memory_order_relaxed);
+    hint_count = 0;
+}
+
+size_t ColumnBase::bytes(void) const {
+    const ColumnChunk* dir = chunks.load(std::memory_order_relaxed);
+    size_t total = ((size_t) maxchunks) * sizeof(ColumnChunk);
+    for (uint32_t n = 0; n < nchunks; n++) {
+        total += ((size_t) dir[n].capacity) * elsize;
+    }
+    return total;
+}
+
+// paged columns: find (and fault in) the chunk holding element n
+uint8_t* ColumnBase::locate(uint64_t n, uint32_t size) {
+    ColumnChunk* dir = chunks.load(std::memory_order_relaxed);
+    auto it = std::upper_bound(dir, dir + nchunks, n,
+                               [](uint64_t n, const ColumnChunk& c) { return n < c.first; });
+    uint32_t idx = (it - dir) - 1;
+    ColumnChunk& c = dir[idx];
+    c.epoch = column_epoch;
+    if (c.data == nullptr) {
+        elsize = size;
+        pager->fault(*this, idx);
+    }
+    hint_first = c.first;
+    hint_count = c.count;
+    hint_data = c.data;
+    hint_epoch = column_epoch;
+    return c.data + (n - c.first) * size;
+}
+
+// the reserved chunk is exact rather than a pool page, so a large
+// track does not waste up to half of it
+void ColumnBase::reserve(uint64_t n, uint32_t size) {
+    if ((n == 0) || (nchunks != 0) || (pager != nullptr)) {
+        return;
+    }
+    n = std::min(n, (uint64_t) 0xFFFFFFFF);
+    elsize = size;
+    ColumnChunk c;
+    c.first = 0;
+    c.count = 0;
+    c.capacity = n;
+    c.data = (uint8_t*) malloc(n * size);
+    c.epoch = 0;
+    c.key = 0;
+    add_chunk(c);
+    base = n;
+}
+
+// start a new owned chunk, holding one (uninitialized) element
+uint8_t* ColumnBase::grow(uint32_t size) {
+    elsize = size;
+    uint32_t grown = nchunks - (base != 0);
+    uint32_t shift = std::min(COLUMN_CHUNK_MIN_SHIFT + grown, (uint32_t) COLUMN_CHUNK_MAX_SHIFT);
+    ColumnChunk c;
+    c.first = filled;
+    c.count = 1;
+    c.capacity = 1u << shift;
+    c.data = page_pool.alloc(((size_t) c.capacity) * size);
+    c.epoch = 0;
+    c.key = 0;
+    add_chunk(c);
+    return c.data;
+}
+
+void ColumnPager::fault(ColumnBase& col, uint32_t n) {
+    ColumnChunk& c = col.chunks.load(std::memory_order_relaxed)[n];
+    if (!load(col, c)) {
+        // keep going with an empty chunk rather than crash mid-frame
+        fprintf(stderr, "error: cannot load chunk %u of column %u\n", n, col.id);
+        c.data = (uint8_t*) calloc(c.count, col.elsize);
+    }
+    c.capacity = c.count;
+    resident += ((size_t) c.count) * col.elsize;
+
+    Entry e;
+    e.col = &col;
+    e.chunk = n;
+    e.epoch = c.epoch;
+    lru.push_back(e);
+    trim();
+}
+
+// a clock sweep: chunks used since they were queued get another
+// round, chunks used this epoch may be referenced and are kept
+void ColumnPager::trim(void) {
+    size_t scan = lru.size() * 2;
+    while ((resident > budget) && scan--) {
+        Entry e = lru.front();
+        lru.pop_front();
+        ColumnChunk& c = e.col->chunks.load(std::memory_order_relaxed)[e.chunk];
+        if ((c.epoch == column_epoch) || (c.epoch != e.epoch)) {
+            e.epoch = c.epoch;
+            lru.push_back(e);
+            continue;
+        }
+        resident -= ((size_t) c.count) * e.col->elsize;
+        free(c.data);
+        c.data = nullptr;
+        c.capacity = 0;
+    }
+}
+
+};
@@ -0,0 +1,252 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <deque>
+#include <iterator>
+#include <vector>
+
+namespace tv {
+
+// A Column is a std::vector-like array stored as a list of chunks.
+// Chunks are either owned (grown by push_back) or paged: supplied by a
+// ColumnPager on first use and dropped again under its memory budget.
+//
+// Owned columns are single producer / single consumer safe: chunks
+// never move once allocated, the chunk directory is replaced rather
+// than reallocated in place (old copies are kept until clear()), and
+// the length is published with release ordering after the element is
+// written. So one thread may push_back() while another reads any
+// index below size(), without locks on either side. Elements already
+// published must not be modified while someone else may read them;
+// append() lets the producer fill an element in before publish().
+//
+// Paged columns are for one thread only. References into them stay
+// valid until the next safe point (column_tick()), after which any
+// chunk not used since may be evicted. The UI ticks between frames;
+// bulk passes tick between tracks. Epochs are per thread, so traces
+// imported on different threads do not end each other's epochs.
+
+extern thread_local uint32_t column_epoch;
+
+static inline void column_tick(void) {
+    column_epoch++;
+}
+
+// owned chunks double from COLUMN_CHUNK_MIN up to COLUMN_CHUNK_MAX
+// elements, so the chunk holding an index is found arithmetically;
+// their memory comes from a page pool shared by all owned columns.
+// A column reserve()d up front has one flat chunk of that size first
+// and only grows chunks after it if the estimate was short.
+#define COLUMN_CHUNK_MIN_SHIFT 6
+#define COLUMN_CHUNK_MAX_SHIFT 14
+#define COLUMN_CHUNK_MIN (1 << COLUMN_CHUNK_MIN_SHIFT)
+#define COLUMN_CHUNK_MAX (1 << COLUMN_CHUNK_MAX_SHIFT)
+#define COLUMN_GROWN ((COLUMN_CHUNK_MAX_SHIFT - COLUMN_CHUNK_MIN_SHIFT) + 1)
+// index of the first element in the first full size chunk
+#define COLUMN_GROWN_FIRST (COLUMN_CHUNK_MIN * ((1 << COLUMN_GROWN) - 1))
+
+struct ColumnChunk {
+    uint64_t first;    // index of the chunk's first element
+    uint32_t count;
+    uint32_t capacity; // elements allocated, 0 while not resident
+    uint8_t* data;
+    uint32_t epoch;    // last epoch the chunk was used in
+    uint32_t key;      // where the pager finds this chunk
+};
+
+struct ColumnBase;
+
+struct ColumnPager {
+    size_t budget;   // bytes of resident paged chunks to aim for
+    size_t resident;
+
+    ColumnPager() : budget((size_t) -1), resident(0) {}
+    virtual ~ColumnPager() {}
+
+    // allocate (with malloc) and fill c.data with c.count elements
+    virtual bool load(ColumnBase& col, ColumnChunk& c) = 0;
+
+    // hint that [t0,t1) will likely be looked at soon
+    virtual void prefetch(int64_t t0, int64_t t1) {}
+
+    // make chunk n of col resident
+    void fault(ColumnBase& col, uint32_t n);
+
+    // evict chunks not used this epoch until within budget
+    void trim(void);
+
+private:
+    struct Entry {
+        ColumnBase* col;
+        uint32_t chunk;
+        uint32_t epoch;
+    };
+    std::deque<Entry> lru;
+};
+
+struct ColumnBase {
+    std::atomic<ColumnChunk*> chunks; // the chunk directory
+    std::atomic<uint64_t> count;      // published length
+    uint64_t filled;                  // appended length, producer only
+    uint64_t base;                    // elements in the reserved chunk
+    uint32_t nchunks;
+    uint32_t maxchunks;
+    std::vector<ColumnChunk*> retired; // outgrown directories
+    ColumnPager* pager;
+    uint32_t id;     // the pager's name for this column
+    uint32_t elsize;
+
+    // the paged chunk last looked up, for sequential access
+    uint64_t hint_first;
+    uint64_t hint_count;
+    uint8_t* hint_data;
+    uint32_t hint_epoch;
+
+    ColumnBase() : chunks(nullptr), count(0), filled(0), base(0), nchunks(0), maxchunks(0),
+                   pager(nullptr), id(0), elsize(0),
+                   hint_first(0), hint_count(0), hint_data(nullptr), hint_epoch(0) {}
+    ~ColumnBase() {
+        clear();
+    }
+    ColumnBase(const ColumnBase&) = delete;
+    ColumnBase& operator=(const ColumnBase&) = delete;
+
+    uint64_t size(void) const {
+        return count.load(std::memory_order_acquire);
+    }
+    bool empty(void) const {
+        return size() == 0;
+    }
+
+    // make everything append()ed visible to readers
+    void publish(void) {
+        count.store(filled, std::memory_order_release);
+    }
+
+    // paged columns: add a chunk of n elements that the pager will
+    // load by key on first use
+    void append_chunk(uint32_t n, uint32_t key);
+
+    // owned columns, while still empty: allocate room for n elements
+    // in one chunk
+    void reserve(uint64_t n, uint32_t size);
+
+    // free every chunk, nothing may be reading the column
+    void clear(void);
+
+    // bytes allocated for the column, counting paged chunks only
+    // while resident
+    size_t bytes(void) const;
+
+    // owned columns: the chunk and offset holding element n
+    static inline uint32_t owned_chunk(uint64_t n, uint64_t* offset) {
+        if (n >= COLUMN_GROWN_FIRST) {
+            n -= COLUMN_GROWN_FIRST;
+            *offset = n & (COLUMN_CHUNK_MAX - 1);
+            return COLUMN_GROWN + (n >> COLUMN_CHUNK_MAX_SHIFT);
+        }
+        uint32_t k = 63 - __builtin_clzll((n >> COLUMN_CHUNK_MIN_SHIFT) + 1);
+        *offset = n - COLUMN_CHUNK_MIN * ((1ULL << k) - 1);
+        return k;
+    }
+
+    uint8_t* locate(uint64_t n, uint32_t size);
+    uint8_t* grow(uint32_t size);
+    void add_chunk(const ColumnChunk& c);
+};
+
+template <typename T>
+struct Column : ColumnBase {
+    struct iterator : std::iterator<std::random_access_iterator_tag, T> {
+        Column* col;
+        uint64_t idx;
+
+        iterator() : col(nullptr), idx(0) {}
+        iterator(Column* c, uint64_t n) : col(c), idx(n) {}
+
+        T& operator*() const { return (*col)[idx]; }
+        T* operator->() const { return &(*col)[idx]; }
+        T& operator[](ptrdiff_t n) const { return (*col)[idx + n]; }
+
+        iterator& operator++() { idx++; return *this; }
+        iterator& operator--() { idx--; return *this; }
+        iterator operator++(int) { iterator it = *this; idx++; return it; }
+        iterator operator--(int) { iterator it = *this; idx--; return it; }
+        iterator& operator+=(ptrdiff_t n) { idx += n; return *this; }
+        iterator& operator-=(ptrdiff_t n) { idx -= n; return *this; }
+        iterator operator+(ptrdiff_t n) const { return iterator(col, idx + n); }
+        iterator operator-(ptrdiff_t n) const { return iterator(col, idx - n); }
+        ptrdiff_t operator-(const iterator& other) const { return idx - other.idx; }
+
+        bool operator==(const iterator& other) const { return idx == other.idx; }
+        bool operator!=(const iterator& other) const { return idx != other.idx; }
+        bool operator<(const iterator& other) const { return idx < other.idx; }
+        bool operator>(const iterator& other) const { return idx > other.idx; }
+        bool operator<=(const iterator& other) const { return idx <= other.idx; }
+        bool operator>=(const iterator& other) const { return idx >= other.idx; }
+    };
+
+    T& operator[](uint64_t n) {
+        if (pager == nullptr) {
+            ColumnChunk* dir = chunks.load(std::memory_order_acquire);
+            if (n < base) {
+                return ((T*) dir[0].data)[n];
+            }
+            uint64_t offset;
+            uint32_t k = owned_chunk(n - base, &offset) + (base != 0);
+            return ((T*) dir[k].data)[offset];
+        }
+        if (((n - hint_first) >= hint_count) || (hint_epoch != column_epoch)) {
+            return *((T*) locate(n, sizeof(T)));
+        }
+        return ((T*) hint_data)[n - hint_first];
+    }
+    const T& operator[](uint64_t n) const {
+        return (*const_cast<Column*>(this))[n];
+    }
+
+    void reserve(uint64_t n) {
+        ColumnBase::reserve(n, sizeof(T));
+    }
+
+    iterator begin(void) {
+        return iterator(this, 0);
+    }
+    iterator end(void) {
+        return iterator(this, size());
+    }
+    T& back(void) {
+        return (*this)[size() - 1];
+    }
+
+    // owned columns only: add an element, not yet visible to readers
+    T& append(const T& value) {
+        ColumnChunk* dir = chunks.load(std::memory_order_relaxed);
+        uint8_t* ptr;
+        if ((nchunks == 0) || (dir[nchunks - 1].count == dir[nchunks - 1].capacity)) {
+            ptr = grow(sizeof(T));
+        } else {
+            ColumnChunk& c = dir[nchunks - 1];
+            ptr = c.data + c.count * sizeof(T);
+            c.count++;
+        }
+        *((T*) ptr) = value;
+        filled++;
+        return *((T*) ptr);
+    }
+
+    void push_back(const T& value) {
+        append(value);
+        publish();
+    }
+};
+
+};
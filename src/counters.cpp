@@ -0,0 +1,183 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+#include <queue>
+
+#include "traceviz.h"
+
+namespace tv {
+
+// level 0 buckets are at least this wide (ns), and there are at most
+// this many of them, which bounds memory for long traces
+#define COUNTER_MIN_NS 1000
+#define COUNTER_MAX_BUCKETS (1 << 18)
+
+unsigned Counter::level_for(int64_t ns) const {
+    unsigned level = 0;
+    while (((level + 1) < min.size()) && ((width << (level + 1)) <= ns)) {
+        level++;
+    }
+    return level;
+}
+
+bool Counter::range(unsigned level, int64_t t0, int64_t t1, float* lo, float* hi) const {
+    int64_t w = width << level;
+    const std::vector<float>& mn = min[level];
+    const std::vector<float>& mx = max[level];
+    if ((t1 <= this->t0) || (t0 >= (this->t0 + w * (int64_t) mn.size()))) {
+        return false;
+    }
+    int64_t b0 = std::max((int64_t) 0, (t0 - this->t0) / w);
+    int64_t b1 = std::min((int64_t) mn.size() - 1, (t1 - 1 - this->t0) / w);
+    *lo = mn[b0];
+    *hi = mx[b0];
+    for (int64_t b = b0 + 1; b <= b1; b++) {
+        *lo = std::min(*lo, mn[b]);
+        *hi = std::max(*hi, mx[b]);
+    }
+    return true;
+}
+
+static Counter* counter_create(std::vector<Counter>& counters, const char* name,
+                               int64_t t0, int64_t width, size_t buckets) {
+    counters.push_back(Counter());
+    Counter* c = &counters.back();
+    c->name = name;
+    c->t0 = t0;
+    c->width = width;
+    c->vmax = 0;
+    c->min.resize(1);
+    c->max.resize(1);
+    c->min[0].assign(buckets, 0);
+    c->max[0].assign(buckets, 0);
+    return c;
+}
+
+void Counter::build_levels(void) {
+    min.resize(1);
+    max.resize(1);
+    while (min.back().size() > 1) {
+        const std::vector<float>& mn = min.back();
+        const std::vector<float>& mx = max.back();
+        std::vector<float> nmn((mn.size() + 1) / 2);
+        std::vector<float> nmx((mn.size() + 1) / 2);
+        for (size_t n = 0; n < mn.size(); n++) {
+            if (n & 1) {
+                nmn[n / 2] = std::min(nmn[n / 2], mn[n]);
+                nmx[n / 2] = std::max(nmx[n / 2], mx[n]);
+            } else {
+                nmn[n / 2] = mn[n];
+                nmx[n / 2] = mx[n];
+            }
+        }
+        min.push_back(nmn);
+        max.push_back(nmx);
+    }
+    vmax = max.back().empty() ? 0 : max.back()[0];
+}
+
+// sweep every thread's state transitions in time order, tracking how
+// many threads are running (cpus busy) and ready (waiting for a cpu)
+static void sweep_states(Trace& trace, Counter* busy, Counter* ready) {
+    std::priority_queue<TrackCursor> heap;
+    std::vector<uint8_t> state(trace.tracks.size(), TS_NONE);
+    for (Track* t : trace.tracks) {
+        // counting idle threads as running would show every cpu busy
+        if (t->task.size() && !is_idle_track(t)) {
+            TrackCursor tc;
+            tc.ts = t->task[0].ts;
+            tc.trackidx = t->idx;
+            tc.idx = 0;
+            tc.end = t->task.size();
+            heap.push(tc);
+        }
+    }
+
+    int running = 0;
+    int waiting = 0;
+    int64_t cur = 0;
+    size_t merged = 0;
+    while (!heap.empty()) {
+        int64_t ts = heap.top().ts;
+        int64_t b = (ts - busy->t0) / busy->width;
+
+        // buckets start out at the value carried in
+        for (int64_t n = cur + 1; n <= b; n++) {
+            busy->min[0][n] = busy->max[0][n] = running;
+            ready->min[0][n] = ready->max[0][n] = waiting;
+        }
+        cur = b;
+
+        // apply every transition at one timestamp before recording, so
+        // a context switch doesn't show as a momentary dip
+        while (!heap.empty() && (heap.top().ts == ts)) {
+            TrackCursor tc = heap.top();
+            heap.pop();
+            Track* t = trace.tracks[tc.trackidx];
+            uint8_t s = t->task[tc.idx].state;
+            running += (s == TS_RUNNING) - (state[tc.trackidx] == TS_RUNNING);
+            waiting += (s == TS_READY) - (state[tc.trackidx] == TS_READY);
+            state[tc.trackidx] = s;
+            if (++tc.idx < tc.end) {
+                tc.ts = t->task[tc.idx].ts;
+                heap.push(tc);
+            }
+            if ((++merged & 0xFFFF) == 0) {
+                column_tick();
+            }
+        }
+
+        busy->min[0][b] = std::min(busy->min[0][b], (float) running);
+        busy->max[0][b] = std::max(busy->max[0][b], (float) running);
+        ready->min[0][b] = std::min(ready->min[0][b], (float) waiting);
+        ready->max[0][b] = std::max(ready->max[0][b], (float) waiting);
+    }
+}
+
+static void count_rate(Trace& trace, Counter* c, uint32_t tag) {
+    const TagIndex* ti = trace.tag_events(tag);
+    if (ti == nullptr) {
+        return;
+    }
+    std::vector<float>& count = c->max[0];
+    int64_t last = count.size() - 1;
+    for (int64_t ts : ti->ts) {
+        int64_t b = (ts - c->t0) / c->width;
+        count[std::max((int64_t) 0, std::min(b, last))] += 1.0f;
+    }
+    float scale = 1000000000.0f / c->width;
+    for (size_t n = 0; n < count.size(); n++) {
+        count[n] *= scale;
+        c->min[0][n] = count[n];
+    }
+}
+
+void Trace::build_counters(void) {
+    counters.clear();
+    if (residency.tmin > residency.tmax) {
+        return;
+    }
+    int64_t span = residency.tmax - residency.tmin + 1;
+    int64_t width = std::max((int64_t) COUNTER_MIN_NS,
+                             (span + COUNTER_MAX_BUCKETS - 1) / COUNTER_MAX_BUCKETS);
+    size_t buckets = (span + width - 1) / width;
+
+    // counters point into this, it must not reallocate
+    counters.reserve(5);
+    Counter* busy = counter_create(counters, "busy cpus", residency.tmin, width, buckets);
+    Counter* ready = counter_create(counters, "runnable threads", residency.tmin, width, buckets);
+    sweep_states(*this, busy, ready);
+    count_rate(*this, counter_create(counters, "irqs/s", residency.tmin, width, buckets),
+               EVT_IRQ_ENTER);
+    count_rate(*this, counter_create(counters, "syscalls/s", residency.tmin, width, buckets),
+               EVT_SYSCALL_ENTER);
+    count_rate(*this, counter_create(counters, "channel writes/s", residency.tmin, width, buckets),
+               EVT_CHANNEL_WRITE);
+    for (auto& c : counters) {
+        c.build_levels();
+    }
+}
+
+};
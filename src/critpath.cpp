@@ -0,0 +1,146 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+
+#include "traceviz.h"
+
+namespace tv {
+
+// bounds on the work done for a single hop
+#define CP_MAX_STATES 65536  // task states walked back to find a wakeup
+#define CP_MAX_EVENTS 4096   // events looked at for its cause
+#define CP_MAX_WAKES  4096   // KWAIT_WAKEs searched for the waker
+
+static inline bool is_blocked(uint8_t state) {
+    return (state == TS_BLOCKED) || (state == TS_SLEEPING) || (state == TS_SUSPENDED);
+}
+
+void CriticalPath::start(Trace& trace, const EventRef& from) {
+    hops.clear();
+    done = false;
+    Event* e = trace.get_event(from);
+    next_track = from.trackidx;
+    next_ts = e->ts;
+    next_edge = CP_EDGE_NONE;
+}
+
+// find the latest KWAIT_WAKE of queue addr at or before ts (and after
+// t0) by any thread but the unblocked one
+static bool find_waker(Trace& trace, uint64_t addr, uint32_t trackidx,
+                       int64_t t0, int64_t ts, EventRef& out) {
+    const TagIndex* ti = trace.tag_events(EVT_KWAIT_WAKE);
+    if (ti == nullptr) {
+        return false;
+    }
+    size_t n = std::upper_bound(ti->ts.begin(), ti->ts.end(), ts) - ti->ts.begin();
+    for (unsigned count = 0; (n > 0) && (count < CP_MAX_WAKES); count++) {
+        n--;
+        if (ti->ts[n] < t0) {
+            break;
+        }
+        const EventRef& ref = ti->refs[n];
+        if ((ref.trackidx != trackidx) && (kwait_addr(*trace.get_event(ref)) == addr)) {
+            out = ref;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Each hop starts at a thread and a time on it and walks back to when
+// the thread was last woken from a blocked state, then looks just after
+// that wakeup for what caused it: a CHANNEL_READ linked to its write,
+// or a KWAIT_UNBLOCK paired with a KWAIT_WAKE on the same wait queue.
+// The thread and time of the cause start the next hop.
+bool CriticalPath::step(Trace& trace) {
+    if (done) {
+        return false;
+    }
+    if (hops.size() >= CP_MAX_HOPS) {
+        done = true;
+        return false;
+    }
+    Track* t = trace.get_track(next_track);
+    auto begin = t->task.begin();
+    auto end = t->task.end();
+    size_t i = std::upper_bound(begin, end, next_ts,
+                                [](int64_t ts, const TaskState& task) { return ts < task.ts; }) - begin;
+
+    CriticalHop hop;
+    hop.trackidx = next_track;
+    hop.t1 = next_ts;
+    hop.edge = next_edge;
+    hop.cause.trackidx = 0;
+    hop.cause.eventidx = 0;
+    hop.cause_edge = CP_EDGE_NONE;
+
+    // task[i - 1] is the state at next_ts; the wakeup is the transition
+    // out of the last blocked state before it
+    size_t limit = (i > CP_MAX_STATES) ? (i - CP_MAX_STATES) : 0;
+    size_t j = i;
+    while ((j > limit) && (j > 1) && !is_blocked(t->task[j - 2].state)) {
+        j--;
+    }
+    if ((j <= 1) || !is_blocked(t->task[j - 2].state)) {
+        // running since the start of the trace, or too far back
+        hop.t0 = (i > 0) ? t->task[j - 1].ts : next_ts;
+        hops.push_back(hop);
+        done = true;
+        return false;
+    }
+    int64_t blocked = t->task[j - 2].ts;
+    int64_t woken = t->task[j - 1].ts;
+    hop.t0 = woken;
+
+    // the cause shows up on the woken thread once it runs again, so
+    // look from when it blocked to the end of its first run after
+    int64_t until = next_ts;
+    for (size_t k = j - 1; (k + 1) < t->task.size(); k++) {
+        if (t->task[k].state == TS_RUNNING) {
+            until = std::min(next_ts, t->task[k + 1].ts);
+            break;
+        }
+    }
+    auto ebegin = t->event.begin();
+    auto eend = t->event.end();
+    auto e = std::lower_bound(ebegin, eend, blocked);
+    EventRef cause;
+    bool found = false;
+    for (unsigned count = 0; (e != eend) && (e->ts <= until) && (count < CP_MAX_EVENTS); ++e, count++) {
+        if ((e->tag == EVT_CHANNEL_READ) && e->eventidx) {
+            Event* wr = &trace.get_track(e->trackidx)->event[e->eventidx];
+            if (wr->ts <= e->ts) {
+                hop.cause.trackidx = next_track;
+                hop.cause.eventidx = e - ebegin;
+                hop.cause_edge = CP_EDGE_IPC;
+                next_track = e->trackidx;
+                next_ts = wr->ts;
+                found = true;
+                break;
+            }
+        } else if (e->tag == EVT_KWAIT_UNBLOCK) {
+            if (find_waker(trace, kwait_addr(*e), next_track, blocked, e->ts, cause)) {
+                hop.cause.trackidx = next_track;
+                hop.cause.eventidx = e - ebegin;
+                hop.cause_edge = CP_EDGE_WAKE;
+                next_track = cause.trackidx;
+                next_ts = trace.get_event(cause)->ts;
+                found = true;
+                break;
+            }
+        }
+    }
+    hops.push_back(hop);
+
+    // no known cause (a timer, an interrupt), or no progress back in time
+    if (!found || (next_ts >= hop.t1)) {
+        done = true;
+        return false;
+    }
+    next_edge = hop.cause_edge;
+    return true;
+}
+
+};
@@ -0,0 +1,173 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include "traceviz.h"
+
+namespace tv {
+
+// Thread ids differ from one boot to the next, so threads are known by
+// their process and thread names with the " (tid)" suffix that
+// evt_thread_name() adds dropped.
+static std::string thread_key(Track* t) {
+    const char* name = t->name;
+    size_t len = strlen(name);
+    if ((len > 0) && (name[len - 1] == ')')) {
+        const char* p = strrchr(name, '(');
+        if ((p != nullptr) && (p > name) && (p[-1] == ' ')) {
+            const char* d = p + 1;
+            while (isdigit(*d)) {
+                d++;
+            }
+            if ((d > (p + 1)) && (*d == ')')) {
+                len = (p - 1) - name;
+            }
+        }
+    }
+    std::string key = t->group ? t->group->name : "?";
+    key += " / ";
+    key.append(name, len);
+    return key;
+}
+
+// Threads with the same key are paired in the order their tracks were
+// created, which is the order they first showed up in each trace.
+static void match_threads(Trace& a, Trace& b, std::vector<DiffThread>& out) {
+    std::map<std::string, std::pair<std::vector<uint32_t>, std::vector<uint32_t>>> keys;
+    for (Track* t : a.tracks) {
+        keys[thread_key(t)].first.push_back(t->idx);
+    }
+    for (Track* t : b.tracks) {
+        keys[thread_key(t)].second.push_back(t->idx);
+    }
+    ResidencyReport ra, rb;
+    a.residency.query(a, -0x7FFFFFFFFFFFFFFFL, 0x7FFFFFFFFFFFFFFFL, ra);
+    b.residency.query(b, -0x7FFFFFFFFFFFFFFFL, 0x7FFFFFFFFFFFFFFFL, rb);
+
+    // the names live in the name pool, so building again leaks nothing
+    out.clear();
+    for (auto& k : keys) {
+        auto& ia = k.second.first;
+        auto& ib = k.second.second;
+        for (size_t n = 0; (n < ia.size()) || (n < ib.size()); n++) {
+            DiffThread d;
+            memset(&d, 0, sizeof(d));
+            d.name = a.intern(k.first.c_str());
+            d.a = (n < ia.size()) ? (int32_t) ia[n] : -1;
+            d.b = (n < ib.size()) ? (int32_t) ib[n] : -1;
+            if (d.a >= 0) {
+                d.time_a = ra.threads[d.a];
+            }
+            if (d.b >= 0) {
+                d.time_b = rb.threads[d.b];
+            }
+            out.push_back(d);
+        }
+    }
+}
+
+struct SyscallTimes {
+    uint32_t count;
+    int64_t total;
+    int64_t max;
+};
+
+// time from each SYSCALL_ENTER to the SYSCALL_EXIT of the same call on
+// the same thread, keyed by syscall name
+static void syscall_times(Trace& trace, std::map<std::string, SyscallTimes>& out) {
+    std::map<uint32_t, SyscallTimes> bynum;
+    for (Track* t : trace.tracks) {
+        bool inside = false;
+        uint32_t num = 0;
+        int64_t t0 = 0;
+        for (auto& e : t->event) {
+            if (e.tag == EVT_SYSCALL_ENTER) {
+                inside = true;
+                num = e.a;
+                t0 = e.ts;
+            } else if ((e.tag == EVT_SYSCALL_EXIT) && inside && (e.a == num)) {
+                SyscallTimes& st = bynum[num];
+                int64_t dur = e.ts - t0;
+                st.count++;
+                st.total += dur;
+                st.max = std::max(st.max, dur);
+                inside = false;
+            }
+        }
+        column_tick();
+    }
+    for (auto& it : bynum) {
+        const char* name = trace.syscall_name(it.first);
+        char tmp[32];
+        if (name == nullptr) {
+            snprintf(tmp, sizeof(tmp), "sys_%u", it.first);
+            name = tmp;
+        }
+        SyscallTimes& st = out[name];
+        st.count += it.second.count;
+        st.total += it.second.total;
+        st.max = std::max(st.max, it.second.max);
+    }
+}
+
+static void event_counts(Trace& trace, std::map<std::string, uint32_t>& out) {
+    for (auto& it : trace.tag_index) {
+        const char* name = (it.first >= EVT_PROBE) ? trace.probe_name(it.first) : evtname(it.first);
+        char tmp[32];
+        if (name == nullptr) {
+            snprintf(tmp, sizeof(tmp), "probe %03x", it.first);
+            name = tmp;
+        }
+        out[name] += it.second.ts.size();
+    }
+}
+
+void TraceDiff::build(Trace& a, Trace& b) {
+    match_threads(a, b, threads);
+
+    std::map<std::string, SyscallTimes> sa, sb;
+    syscall_times(a, sa);
+    syscall_times(b, sb);
+    for (auto& it : sb) {
+        sa[it.first];
+    }
+    syscalls.clear();
+    for (auto& it : sa) {
+        const SyscallTimes& x = it.second;
+        const SyscallTimes& y = sb[it.first];
+        DiffSyscall d;
+        d.name = a.intern(it.first.c_str());
+        d.count_a = x.count;
+        d.count_b = y.count;
+        d.mean_a = x.count ? (x.total / x.count) : 0;
+        d.mean_b = y.count ? (y.total / y.count) : 0;
+        d.max_a = x.max;
+        d.max_b = y.max;
+        syscalls.push_back(d);
+    }
+
+    std::map<std::string, uint32_t> ea, eb;
+    event_counts(a, ea);
+    event_counts(b, eb);
+    for (auto& it : eb) {
+        ea[it.first];
+    }
+    events.clear();
+    for (auto& it : ea) {
+        DiffCount d;
+        d.name = a.intern(it.first.c_str());
+        d.a = it.second;
+        d.b = eb[it.first];
+        events.push_back(d);
+    }
+}
+
+};
@@ -0,0 +1,429 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "native.h"
+#include "traceviz.h"
+#include "writer.h"
+
+namespace tv {
+
+// Exporters stream straight from the Track arrays through a Writer,
+// one group and track at a time, so no output document is built in
+// memory.  Groups become processes and tracks become threads.
+
+// A channel write that some read was linked to starts a flow,
+// with an id derived from the write's location.
+static inline uint64_t flow_id(uint32_t trackidx, uint32_t eventidx) {
+    return (((uint64_t) trackidx) << 32) | eventidx;
+}
+
+// one bit per event: is this a write that a read was linked to
+static void find_flow_sources(Trace& trace, std::vector<std::vector<bool>>& src) {
+    src.resize(trace.tracks.size());
+    for (Track* t : trace.tracks) {
+        for (auto& e : t->event) {
+            // same convention as the flow drawing: eventidx 0 is no link
+            if ((e.tag != EVT_CHANNEL_READ) || !e.eventidx) {
+                continue;
+            }
+            auto& bits = src[e.trackidx];
+            if (bits.size() == 0) {
+                bits.resize(trace.tracks[e.trackidx]->event.size());
+            }
+            bits[e.eventidx] = true;
+        }
+        column_tick();
+    }
+}
+
+static bool is_flow_source(std::vector<std::vector<bool>>& src,
+                           uint32_t trackidx, uint32_t eventidx) {
+    auto& bits = src[trackidx];
+    return (eventidx < bits.size()) && bits[eventidx];
+}
+
+static const char* export_event_name(Trace& trace, const Event& e, char* tmp, size_t len) {
+    if (e.tag >= EVT_PROBE) {
+        const char* name = trace.probe_name(e.tag);
+        if (name) {
+            return name;
+        }
+        snprintf(tmp, len, "probe_%03x", e.tag);
+        return tmp;
+    }
+    if ((e.tag == EVT_SYSCALL_ENTER) || (e.tag == EVT_SYSCALL_EXIT)) {
+        const char* name = trace.syscall_name(e.a);
+        if (name) {
+            snprintf(tmp, len, "%s %s", (e.tag == EVT_SYSCALL_ENTER) ? "SYSCALL" : "SYSRETN", name);
+        } else {
+            snprintf(tmp, len, "%s sys_%u", (e.tag == EVT_SYSCALL_ENTER) ? "SYSCALL" : "SYSRETN", e.a);
+        }
+        return tmp;
+    }
+    return evtname(e.tag);
+}
+
+// the exported timeline must not go negative (perfetto timestamps are
+// unsigned), so find the earliest time in the model
+static int64_t export_base(Trace& trace) {
+    int64_t base = 0;
+    for (Track* t : trace.tracks) {
+        if (t->task.size() && (t->task[0].ts < base)) {
+            base = t->task[0].ts;
+        }
+        if (t->event.size() && (t->event[0].ts < base)) {
+            base = t->event[0].ts;
+        }
+    }
+    return base;
+}
+
+// ---- Chrome Trace Event JSON ----
+
+static void json_string(Writer& w, const char* s) {
+    w.putc('"');
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if ((c == '"') || (c == '\\')) {
+            w.putc('\\');
+            w.putc(c);
+        } else if (c < 0x20) {
+            w.puts("\\u00");
+            w.hex(c, 2);
+        } else {
+            w.putc(c);
+        }
+    }
+    w.putc('"');
+}
+
+// nanoseconds as fractional microseconds
+static void json_ts(Writer& w, int64_t ts) {
+    w.dec(ts / 1000);
+    w.putc('.');
+    w.dec((ts % 1000) / 100);
+    w.dec((ts % 100) / 10);
+    w.dec(ts % 10);
+}
+
+static void json_ids(Writer& w, Group* g, Track* t) {
+    w.puts("\"pid\":");
+    w.dec(g->id);
+    w.puts(",\"tid\":");
+    w.dec(t->id);
+}
+
+int export_json(Trace& trace, int fd) {
+    Writer w(fd);
+    std::vector<std::vector<bool>> flows;
+    find_flow_sources(trace, flows);
+    int64_t base = export_base(trace);
+    char tmp[128];
+
+    w.puts("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    auto next = [&]() {
+        if (!first) {
+            w.puts(",\n");
+        }
+        first = false;
+    };
+
+    for (Group* g = trace.get_groups(); g != nullptr; g = g->next) {
+        next();
+        w.puts("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":");
+        w.dec(g->id);
+        w.puts(",\"args\":{\"name\":");
+        json_string(w, g->name);
+        w.puts("}}");
+
+        for (Track* t = g->first; t != nullptr; t = t->next) {
+            column_tick();
+            next();
+            w.puts("{\"ph\":\"M\",\"name\":\"thread_name\",");
+            json_ids(w, g, t);
+            w.puts(",\"args\":{\"name\":");
+            json_string(w, t->name);
+            w.puts("}}");
+
+            // task state runs as complete events
+            for (size_t n = 0; (n + 1) < t->task.size(); n++) {
+                const TaskState& task = t->task[n];
+                if (task.state >= TS_NONE) {
+                    continue;
+                }
+                next();
+                w.puts("{\"ph\":\"X\",\"cat\":\"state\",\"name\":");
+                json_string(w, state_name(task.state));
+                w.putc(',');
+                json_ids(w, g, t);
+                w.puts(",\"ts\":");
+                json_ts(w, task.ts - base);
+                w.puts(",\"dur\":");
+                json_ts(w, t->task[n + 1].ts - task.ts);
+                w.puts(",\"args\":{\"cpu\":");
+                w.dec(task.cpu);
+                w.puts("}}");
+            }
+
+            // events as thread scoped instants, channel links as flows
+            for (size_t n = 0; n < t->event.size(); n++) {
+                const Event& e = t->event[n];
+                next();
+                w.puts("{\"ph\":\"i\",\"s\":\"t\",\"cat\":\"event\",\"name\":");
+                json_string(w, export_event_name(trace, e, tmp, sizeof(tmp)));
+                w.putc(',');
+                json_ids(w, g, t);
+                w.puts(",\"ts\":");
+                json_ts(w, e.ts - base);
+                w.puts(",\"args\":{\"a\":");
+                w.dec(e.a);
+                w.puts(",\"b\":");
+                w.dec(e.b);
+                w.puts("}}");
+
+                if ((e.tag == EVT_CHANNEL_WRITE) && is_flow_source(flows, t->idx, n)) {
+                    next();
+                    w.puts("{\"ph\":\"s\",\"cat\":\"ipc\",\"name\":\"message\",\"id\":");
+                    w.dec(flow_id(t->idx, n));
+                    w.putc(',');
+                    json_ids(w, g, t);
+                    w.puts(",\"ts\":");
+                    json_ts(w, e.ts - base);
+                    w.putc('}');
+                } else if ((e.tag == EVT_CHANNEL_READ) && e.eventidx) {
+                    next();
+                    w.puts("{\"ph\":\"f\",\"bp\":\"e\",\"cat\":\"ipc\",\"name\":\"message\",\"id\":");
+                    w.dec(flow_id(e.trackidx, e.eventidx));
+                    w.putc(',');
+                    json_ids(w, g, t);
+                    w.puts(",\"ts\":");
+                    json_ts(w, e.ts - base);
+                    w.putc('}');
+                }
+            }
+        }
+    }
+    w.puts("\n]}\n");
+    return w.flush();
+}
+
+// ---- Perfetto protobuf (perfetto.protos.Trace) ----
+
+// field numbers from perfetto/trace/trace_packet.proto and friends
+#define PB_TRACE_PACKET          1
+#define PB_PACKET_TIMESTAMP      8
+#define PB_PACKET_SEQUENCE_ID    10
+#define PB_PACKET_TRACK_EVENT    11
+#define PB_PACKET_TRACK_DESC     60
+#define PB_DESC_UUID             1
+#define PB_DESC_NAME             2
+#define PB_DESC_PROCESS          3
+#define PB_DESC_THREAD           4
+#define PB_DESC_PARENT_UUID      5
+#define PB_PROCESS_PID           1
+#define PB_PROCESS_NAME          6
+#define PB_THREAD_PID            1
+#define PB_THREAD_TID            2
+#define PB_THREAD_NAME           5
+#define PB_EVENT_TYPE            9
+#define PB_EVENT_TRACK_UUID      11
+#define PB_EVENT_NAME            23
+#define PB_EVENT_FLOW_IDS        47
+#define PB_EVENT_TERMINATING_FLOW_IDS 48
+
+#define PB_TYPE_SLICE_BEGIN      1
+#define PB_TYPE_SLICE_END        2
+#define PB_TYPE_INSTANT          3
+
+#define PB_VARINT  0
+#define PB_FIXED64 1
+#define PB_BYTES   2
+
+#define PB_SEQUENCE_ID 1
+
+// a protobuf message under construction, reused between packets
+struct Proto {
+    std::vector<uint8_t> buf;
+
+    void clear() {
+        buf.clear();
+    }
+    void varint(uint64_t v) {
+        while (v >= 0x80) {
+            buf.push_back((v & 0x7F) | 0x80);
+            v >>= 7;
+        }
+        buf.push_back(v);
+    }
+    void key(uint32_t field, uint32_t wire) {
+        varint((field << 3) | wire);
+    }
+    void u64(uint32_t field, uint64_t v) {
+        key(field, PB_VARINT);
+        varint(v);
+    }
+    void fixed64(uint32_t field, uint64_t v) {
+        key(field, PB_FIXED64);
+        for (unsigned n = 0; n < 8; n++) {
+            buf.push_back(v >> (n * 8));
+        }
+    }
+    void bytes(uint32_t field, const void* data, size_t len) {
+        key(field, PB_BYTES);
+        varint(len);
+        buf.insert(buf.end(), (const uint8_t*) data, ((const uint8_t*) data) + len);
+    }
+    void str(uint32_t field, const char* s) {
+        bytes(field, s, strlen(s));
+    }
+    void msg(uint32_t field, const Proto& p) {
+        bytes(field, p.buf.data(), p.buf.size());
+    }
+};
+
+struct PerfettoExport {
+    Writer& w;
+    Proto packet;
+    Proto body;
+    Proto inner;
+    Proto hdr;
+
+    PerfettoExport(Writer& _w) : w(_w) {}
+
+    // wrap the packet as one repeated Trace.packet field
+    void emit() {
+        hdr.clear();
+        hdr.key(PB_TRACE_PACKET, PB_BYTES);
+        hdr.varint(packet.buf.size());
+        w.write(hdr.buf.data(), hdr.buf.size());
+        w.write(packet.buf.data(), packet.buf.size());
+    }
+
+    void event(uint64_t ts, uint64_t uuid, uint32_t type, const char* name,
+               uint64_t flow, uint64_t terminating_flow) {
+        body.clear();
+        body.u64(PB_EVENT_TYPE, type);
+        body.u64(PB_EVENT_TRACK_UUID, uuid);
+        if (name) {
+            body.str(PB_EVENT_NAME, name);
+        }
+        if (flow) {
+            body.fixed64(PB_EVENT_FLOW_IDS, flow);
+        }
+        if (terminating_flow) {
+            body.fixed64(PB_EVENT_TERMINATING_FLOW_IDS, terminating_flow);
+        }
+        packet.clear();
+        packet.u64(PB_PACKET_TIMESTAMP, ts);
+        packet.u64(PB_PACKET_SEQUENCE_ID, PB_SEQUENCE_ID);
+        packet.msg(PB_PACKET_TRACK_EVENT, body);
+        emit();
+    }
+};
+
+// track uuids: processes and threads in disjoint ranges
+#define UUID_PROCESS(n) ((1ULL << 48) | (n))
+#define UUID_THREAD(n)  ((2ULL << 48) | (n))
+
+int export_perfetto(Trace& trace, int fd) {
+    Writer w(fd);
+    PerfettoExport pe(w);
+    std::vector<std::vector<bool>> flows;
+    find_flow_sources(trace, flows);
+    int64_t base = export_base(trace);
+    char tmp[128];
+
+    uint32_t groupno = 0;
+    for (Group* g = trace.get_groups(); g != nullptr; g = g->next, groupno++) {
+        uint64_t puuid = UUID_PROCESS(groupno);
+        pe.inner.clear();
+        pe.inner.u64(PB_PROCESS_PID, g->id);
+        pe.inner.str(PB_PROCESS_NAME, g->name);
+        pe.body.clear();
+        pe.body.u64(PB_DESC_UUID, puuid);
+        pe.body.msg(PB_DESC_PROCESS, pe.inner);
+        pe.packet.clear();
+        pe.packet.msg(PB_PACKET_TRACK_DESC, pe.body);
+        pe.emit();
+
+        for (Track* t = g->first; t != nullptr; t = t->next) {
+            column_tick();
+            uint64_t uuid = UUID_THREAD(t->idx);
+            pe.inner.clear();
+            pe.inner.u64(PB_THREAD_PID, g->id);
+            pe.inner.u64(PB_THREAD_TID, t->id);
+            pe.inner.str(PB_THREAD_NAME, t->name);
+            pe.body.clear();
+            pe.body.u64(PB_DESC_UUID, uuid);
+            pe.body.u64(PB_DESC_PARENT_UUID, puuid);
+            pe.body.msg(PB_DESC_THREAD, pe.inner);
+            pe.packet.clear();
+            pe.packet.msg(PB_PACKET_TRACK_DESC, pe.body);
+            pe.emit();
+
+            // task state runs as begin/end slices
+            bool open = false;
+            for (auto& task : t->task) {
+                if (open) {
+                    pe.event(task.ts - base, uuid, PB_TYPE_SLICE_END, nullptr, 0, 0);
+                    open = false;
+                }
+                if (task.state < TS_NONE) {
+                    pe.event(task.ts - base, uuid, PB_TYPE_SLICE_BEGIN, state_name(task.state), 0, 0);
+                    open = true;
+                }
+            }
+
+            for (size_t n = 0; n < t->event.size(); n++) {
+                const Event& e = t->event[n];
+                uint64_t flow = 0;
+                uint64_t terminating = 0;
+                // flow ids must be nonzero
+                if ((e.tag == EVT_CHANNEL_WRITE) && is_flow_source(flows, t->idx, n)) {
+                    flow = flow_id(t->idx, n);
+                } else if ((e.tag == EVT_CHANNEL_READ) && e.eventidx) {
+                    terminating = flow_id(e.trackidx, e.eventidx);
+                }
+                pe.event(e.ts - base, uuid, PB_TYPE_INSTANT,
+                         export_event_name(trace, e, tmp, sizeof(tmp)), flow, terminating);
+            }
+        }
+    }
+    return w.flush();
+}
+
+// pick the format from the file name: .json for Chrome JSON, .tvz
+// for the native format, anything else (.pftrace, .perfetto-trace,
+// .pb) for Perfetto protobuf
+int export_trace(Trace& trace, const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "error: cannot create '%s'\n", path);
+        return -1;
+    }
+    size_t len = strlen(path);
+    int r;
+    if ((len > 5) && !strcmp(path + len - 5, ".json")) {
+        r = export_json(trace, fd);
+    } else if ((len > 4) && !strcmp(path + len - 4, ".tvz")) {
+        r = write_native(trace, fd);
+    } else {
+        r = export_perfetto(trace, fd);
+    }
+    if (close(fd) < 0) {
+        r = -1;
+    }
+    if (r < 0) {
+        fprintf(stderr, "error: failed writing '%s'\n", path);
+    }
+    return r;
+}
+
+};
@@ -0,0 +1,243 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <math.h>
+#include <stdio.h>
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include <imgui.h>
+
+#include <GL/gl3w.h>
+
+#include "gltracks.h"
+
+using tv::Track;
+using tv::TaskState;
+
+// Each track's task states are uploaded once, on first use, as one
+// instance per state: its timestamp split in 32 bit halves and its
+// state. An interval is drawn as an instanced quad reading the state
+// as its start and the next one as its end, so only the visible index
+// range and the view transform change from frame to frame.
+//
+// The shader subtracts the whole ns of the left edge in 64 bit
+// arithmetic made of 32 bit halves before going to float, then the
+// fraction of a ns left over, so timestamps keep full precision at any
+// zoom.
+
+struct GLTask {
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t state;
+    uint32_t pad;
+};
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+static const char* vertex_shader =
+    "#version 150\n"
+    "uniform uvec2 u_edge;\n"
+    "uniform float u_frac;\n"
+    "uniform float u_tscale;\n"
+    "uniform vec4 u_rect;\n"
+    "uniform vec2 u_display;\n"
+    "uniform vec4 u_colors[" XSTR(TS_LAST) " + 1];\n"
+    "in uvec3 a_t0;\n"
+    "in uvec2 a_t1;\n"
+    "out vec4 v_color;\n"
+    "float rel(uvec2 t) {\n"
+    "    uint lo = t.x - u_edge.x;\n"
+    "    uint hi = t.y - u_edge.y - ((t.x < u_edge.x) ? 1u : 0u);\n"
+    "    if (hi == 0u) return float(lo);\n"
+    "    if (hi == 0xFFFFFFFFu) return -float(0u - lo);\n"
+    "    return float(int(hi)) * 4294967296.0 + float(lo);\n"
+    "}\n"
+    "void main() {\n"
+    "    float w = u_rect.z - u_rect.x;\n"
+    "    float x0 = clamp(floor((rel(a_t0.xy) - u_frac) / u_tscale), 0.0, w);\n"
+    "    float x1 = clamp(floor((rel(a_t1) - u_frac) / u_tscale), 0.0, w);\n"
+    "    float x = u_rect.x + (((gl_VertexID & 1) == 0) ? x0 : x1);\n"
+    "    float y = ((gl_VertexID & 2) == 0) ? u_rect.y : u_rect.w;\n"
+    "    v_color = u_colors[a_t0.z];\n"
+    "    gl_Position = vec4(2.0 * x / u_display.x - 1.0, 1.0 - 2.0 * y / u_display.y, 0.0, 1.0);\n"
+    "}\n";
+
+static const char* fragment_shader =
+    "#version 150\n"
+    "in vec4 v_color;\n"
+    "out vec4 o_color;\n"
+    "void main() {\n"
+    "    o_color = v_color;\n"
+    "}\n";
+
+static GLuint compile(GLenum type, const char* src) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+    GLint ok = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "error: gltracks shader: %s\n", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+bool GLTrackRenderer::init(void) {
+    GLuint vs = compile(GL_VERTEX_SHADER, vertex_shader);
+    GLuint fs = compile(GL_FRAGMENT_SHADER, fragment_shader);
+    if ((vs == 0) || (fs == 0)) {
+        return false;
+    }
+    program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    GLint ok = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        fprintf(stderr, "error: gltracks program did not link\n");
+        glDeleteProgram(program);
+        program = 0;
+        return false;
+    }
+    loc_edge = glGetUniformLocation(program, "u_edge");
+    loc_frac = glGetUniformLocation(program, "u_frac");
+    loc_tscale = glGetUniformLocation(program, "u_tscale");
+    loc_rect = glGetUniformLocation(program, "u_rect");
+    loc_display = glGetUniformLocation(program, "u_display");
+    loc_colors = glGetUniformLocation(program, "u_colors");
+    loc_t0 = glGetAttribLocation(program, "a_t0");
+    loc_t1 = glGetAttribLocation(program, "a_t1");
+
+    GLint vao_last;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao_last);
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glEnableVertexAttribArray(loc_t0);
+    glEnableVertexAttribArray(loc_t1);
+    glVertexAttribDivisor(loc_t0, 1);
+    glVertexAttribDivisor(loc_t1, 1);
+    glBindVertexArray(vao_last);
+    return true;
+}
+
+GLTrack* GLTrackRenderer::upload(Track* t) {
+    auto it = tracks.find(t);
+    if (it != tracks.end()) {
+        return it->second;
+    }
+    GLTrack* gt = new GLTrack;
+    gt->count = t->task.size();
+    std::vector<GLTask> data(gt->count);
+    uint64_t n = 0;
+    for (const TaskState& task : t->task) {
+        GLTask& d = data[n++];
+        d.lo = (uint32_t) task.ts;
+        d.hi = (uint32_t) (((uint64_t) task.ts) >> 32);
+        d.state = (task.state <= TS_LAST) ? task.state : TS_NONE;
+        d.pad = 0;
+    }
+    GLint vbo_last;
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &vbo_last);
+    glGenBuffers(1, &gt->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, gt->vbo);
+    glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(GLTask), data.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_last);
+    tracks[t] = gt;
+    return gt;
+}
+
+// runs inside ImGui's render, between its own draw calls, so leaves
+// the GL state as it found it
+static void draw_pass(const ImDrawList* dl, const ImDrawCmd* cmd) {
+    GLPass* p = (GLPass*) cmd->UserCallbackData;
+    GLTrackRenderer* r = p->r;
+    ImGuiIO& io = ImGui::GetIO();
+
+    GLint program_last, vao_last, vbo_last;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program_last);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao_last);
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &vbo_last);
+
+    float fb_height = io.DisplaySize.y * io.DisplayFramebufferScale.y;
+    const ImVec4& clip = cmd->ClipRect;
+    glScissor((int) (clip.x * io.DisplayFramebufferScale.x),
+              (int) (fb_height - clip.w * io.DisplayFramebufferScale.y),
+              (int) ((clip.z - clip.x) * io.DisplayFramebufferScale.x),
+              (int) ((clip.w - clip.y) * io.DisplayFramebufferScale.y));
+
+    glUseProgram(r->program);
+    glUniform2ui(r->loc_edge, (uint32_t) p->tsedge, (uint32_t) (((uint64_t) p->tsedge) >> 32));
+    glUniform1f(r->loc_frac, p->tsfrac);
+    glUniform1f(r->loc_tscale, p->tscale);
+    glUniform4fv(r->loc_rect, 1, p->rect);
+    glUniform2f(r->loc_display, io.DisplaySize.x, io.DisplaySize.y);
+    glUniform4fv(r->loc_colors, TS_LAST + 1, &p->colors[0][0]);
+
+    glBindVertexArray(r->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, p->track->vbo);
+    size_t offset = p->first * sizeof(GLTask);
+    glVertexAttribIPointer(r->loc_t0, 3, GL_UNSIGNED_INT, sizeof(GLTask), (void*) offset);
+    glVertexAttribIPointer(r->loc_t1, 2, GL_UNSIGNED_INT, sizeof(GLTask),
+                           (void*) (offset + sizeof(GLTask)));
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei) p->count);
+
+    glUseProgram(program_last);
+    glBindVertexArray(vao_last);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_last);
+}
+
+void GLTrackRenderer::frame(void) {
+    passes.clear();
+}
+
+bool GLTrackRenderer::draw(ImDrawList* dl, Track* t, uint64_t first, uint64_t last,
+                           float x0, float y0, float x1, float y1,
+                           double tsedge, double tscale, const uint32_t* colors) {
+    if (program == 0) {
+        return false;
+    }
+    GLTrack* gt = upload(t);
+
+    // an interval ends where the next state starts
+    if ((last + 1) > gt->count) {
+        last = (gt->count > 0) ? (gt->count - 1) : 0;
+    }
+    if (first >= last) {
+        return true;
+    }
+
+    passes.push_back(GLPass());
+    GLPass& p = passes.back();
+    p.r = this;
+    p.track = gt;
+    p.first = first;
+    p.count = last - first;
+    p.rect[0] = x0;
+    p.rect[1] = y0;
+    p.rect[2] = x1;
+    p.rect[3] = y1;
+    p.tsedge = (int64_t) floor(tsedge);
+    p.tsfrac = tsedge - p.tsedge;
+    p.tscale = tscale;
+    for (unsigned n = 0; n <= TS_LAST; n++) {
+        ImVec4 c = ImGui::ColorConvertU32ToFloat4(colors[n]);
+        p.colors[n][0] = c.x;
+        p.colors[n][1] = c.y;
+        p.colors[n][2] = c.z;
+        p.colors[n][3] = c.w;
+    }
+    dl->AddCallback(draw_pass, &p);
+    return true;
+}
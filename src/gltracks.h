@@ -0,0 +1,61 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <deque>
+#include <unordered_map>
+
+#include "traceviz.h"
+
+struct GLTrackRenderer;
+
+// a track's task states as uploaded
+struct GLTrack {
+    unsigned vbo;
+    uint64_t count;
+};
+
+// what one track needs for its draw callback
+struct GLPass {
+    GLTrackRenderer* r;
+    GLTrack* track;
+    uint64_t first;
+    uint64_t count;
+    float rect[4];
+    int64_t tsedge;  // whole ns of the left edge
+    float tsfrac;    // and the rest
+    float tscale;
+    float colors[TS_LAST + 1][4];
+};
+
+// Draws task state intervals as instanced quads from per-track buffers
+// kept on the GPU. Needs an OpenGL 3.2 core context, current whenever
+// init(), draw() or ImGui::Render() is called.
+struct GLTrackRenderer : public TrackRenderer {
+    unsigned program;
+    unsigned vao;
+    int loc_edge;
+    int loc_frac;
+    int loc_tscale;
+    int loc_rect;
+    int loc_display;
+    int loc_colors;
+    int loc_t0;
+    int loc_t1;
+
+    std::unordered_map<tv::Track*,GLTrack*> tracks;
+    std::deque<GLPass> passes; // this frame's, until it is rendered
+
+    GLTrackRenderer() : program(0), vao(0) {}
+
+    // false if the shaders did not build, so the timeline draws as before
+    bool init(void);
+    GLTrack* upload(tv::Track* t);
+
+    virtual void frame(void);
+    virtual bool draw(ImDrawList* dl, tv::Track* t, uint64_t first, uint64_t last,
+                      float x0, float y0, float x1, float y1,
+                      double tsedge, double tscale, const uint32_t* colors);
+};
@@ -2,7 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
-// for strdup
+// for pread, clock_gettime
 #define _POSIX_C_SOURCE 200809L
 
 #include <fcntl.h>
@@ -10,11 +10,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <thread>
+
 #include "ktrace.h"
 
+#include "native.h"
+#include "reader.h"
 #include "traceviz.h"
+#include "writer.h"
 
 namespace tv {
 
@@ -54,6 +61,7 @@ void Trace::group_add_track(Group* group, Track* track) {
         group->first = track;
     }
     group->last = track;
+    track->group = group;
 }
 
 Track* Trace::track_create(void) {
@@ -71,13 +79,24 @@ void Trace::track_append(Track* t, uint64_t ts, uint8_t state, uint8_t cpu) {
     t->task.push_back(task);
 }
 
+// the caller fills in the arguments, so the event is only published
+// to readers (see Column) once the next one is added or the record
+// has been imported
 Event* Trace::track_add_event(Track* t, uint64_t ts, uint32_t tag) {
     Event event;
     memset(&event, 0, sizeof(event));
     event.ts = ts;
     event.tag = tag;
-    t->event.push_back(event);
-    return &t->event.back();
+    publish_pending();
+    unpublished = &t->event;
+    return &t->event.append(event);
+}
+
+void Trace::publish_pending(void) {
+    if (unpublished != nullptr) {
+        unpublished->publish();
+        unpublished = nullptr;
+    }
 }
 
 #define OBJBUCKET(id) fnv1a_tiny(id, HASHBITS)
@@ -122,6 +141,46 @@ Process::Process(uint32_t _id) : Object(_id, KPROC) {
 MsgPipe::MsgPipe(uint32_t _id) : Object(_id, KPIPE), other(nullptr) {
 }
 
+// Tracks and groups are calloc'd and objects new'd as they turn up, so
+// all of them are found again through the trace (a process's group may
+// have been pruned from the list). The pager goes first: its worker
+// reads the columns, and its LRU points at the chunks they free.
+Trace::~Trace() {
+    delete pager;
+    pager = nullptr;
+    for (Track* t : tracks) {
+        t->~Track();
+        free(t);
+    }
+    tracks.clear();
+
+    std::unordered_set<Group*> groups;
+    for (Group* g = group_list; g != nullptr; g = g->next) {
+        groups.insert(g);
+    }
+    for (unsigned n = 0; n < BUCKETS; n++) {
+        Object* next;
+        for (Object* obj = objhash[n]; obj != nullptr; obj = next) {
+            next = obj->next;
+            if (obj->as_process() != nullptr) {
+                groups.insert(obj->as_process()->group);
+            }
+            delete obj;
+        }
+        objhash[n] = nullptr;
+    }
+    Object* next;
+    for (Object* obj = kthread_list; obj != nullptr; obj = next) {
+        next = obj->next;
+        delete obj;
+    }
+    kthread_list = nullptr;
+    for (Group* g : groups) {
+        free(g);
+    }
+    group_list = group_last = nullptr;
+}
+
 void Trace::add_object(Object* object) {
     unsigned n = OBJBUCKET(object->id);
     object->next = objhash[n];
@@ -136,6 +195,7 @@ Process* Trace::find_process(uint32_t id, bool create) {
     if (create) {
         Process* p = new Process(id);
         p->group = group_create();
+        p->group->id = id;
         add_object(p);
         return p;
     }
@@ -150,6 +210,8 @@ Thread* Trace::find_thread(uint32_t id, bool create) {
     if (create) {
         Thread* t = new Thread(id);
         t->track = track_create();
+        t->track->id = id;
+        track_reserve(t->track, id);
         add_object(t);
         return t;
     }
@@ -198,6 +260,8 @@ Thread* Trace::find_kthread(uint32_t id, bool create) {
     // create new kernel thread
     Thread* t = new Thread(id);
     t->track = track_create();
+    t->track->id = id;
+    track_reserve(t->track, (1ULL << 32) | id);
     t->next = kthread_list;
     kthread_list = t;
 
@@ -208,9 +272,7 @@ Thread* Trace::find_kthread(uint32_t id, bool create) {
     return t;
 }
 
-static uint64_t ticks_per_ms;
-
-uint64_t ticks_to_ts(uint64_t ts) {
+uint64_t Trace::ticks_to_ts(uint64_t ts) {
     //TODO: handle overflow for large times
     if (ticks_per_ms) {
         return (ts * 1000000ULL) / ticks_per_ms;
@@ -229,26 +291,82 @@ const char* recname(ktrace_rec_name_t& rec) {
     return rec.name;
 }
 
-int verbose = 0;
-int text = 0;
+
+// The import filters, applied to each record before it is decoded.
+// Most records are judged on their header alone. The few that tell
+// which thread runs on a cpu or which process a thread belongs to are
+// looked into, whether kept or not, to judge the records after them.
+struct RecordFilter {
+    const ImportOptions& opt;
+    bool active;
+    bool by_thread;
+    uint64_t ticks_per_ms;
+    uint64_t base;      // ticks of the first timed record
+    int64_t window0;    // window in ticks from base, once ticks are known
+    int64_t window1;
+    uint32_t running[MAXCPU];
+    std::unordered_map<uint32_t,uint32_t> pid_of; // by tid
+
+    RecordFilter(const ImportOptions& o) : opt(o), ticks_per_ms(0), base(0),
+                                           window0(0), window1(0) {
+        by_thread = opt.pid_count || opt.tid_count;
+        active = opt.group_mask || by_thread || opt.window_t1;
+        memset(running, 0, sizeof(running));
+    }
+
+    bool thread_kept(uint32_t tid) {
+        for (unsigned n = 0; n < opt.tid_count; n++) {
+            if (opt.tids[n] == tid) {
+                return true;
+            }
+        }
+        if (opt.pid_count == 0) {
+            return false;
+        }
+        // kernel threads run as tid 0, in process 0
+        auto it = pid_of.find(tid);
+        uint32_t pid = tid ? ((it != pid_of.end()) ? it->second : 0xFFFFFFFF) : 0;
+        return process_kept(pid);
+    }
+    bool process_kept(uint32_t pid) {
+        for (unsigned n = 0; n < opt.pid_count; n++) {
+            if (opt.pids[n] == pid) {
+                return true;
+            }
+        }
+        return false;
+    }
+    bool cpu_kept(uint32_t cpu) {
+        return (cpu < MAXCPU) && thread_kept(running[cpu]);
+    }
+
+    bool keep(const ktrace_record_t& rec);
+};
 
 void Trace::evt_context_switch(uint64_t ts, uint32_t oldtid, uint32_t newtid,
                                uint32_t state, uint32_t cpu,
                                uint32_t oldthread, uint32_t newthread) {
+    // filtered by thread, a switch between a kept thread and another
+    // only gets the kept one a track
     Thread* t;
-    if (oldtid) {
-        t = find_thread(oldtid);
-    } else {
-        t = find_kthread(oldthread);
+    if ((filter == nullptr) || filter->thread_kept(oldtid)) {
+        if (oldtid) {
+            t = find_thread(oldtid);
+        } else {
+            t = find_kthread(oldthread);
+        }
+        track_append(t->track, ts, state, cpu);
     }
-    track_append(t->track, ts, state, cpu);
 
-    if (newtid) {
-        t = find_thread(newtid);
-    } else {
-        t = find_kthread(newthread);
+    t = nullptr;
+    if ((filter == nullptr) || filter->thread_kept(newtid)) {
+        if (newtid) {
+            t = find_thread(newtid);
+        } else {
+            t = find_kthread(newthread);
+        }
+        track_append(t->track, ts, TS_RUNNING, cpu);
     }
-    track_append(t->track, ts, TS_RUNNING, cpu);
 
     if (cpu >= MAXCPU) {
         return;
@@ -257,11 +375,11 @@ void Trace::evt_context_switch(uint64_t ts, uint32_t oldtid, uint32_t newtid,
 }
 
 void Trace::evt_syscall_name(uint32_t num, const char* name) {
-    syscall_names[num] = strdup(name);
+    syscall_names[num] = intern(name);
 }
 
 void Trace::evt_probe_name(uint32_t num, const char* name) {
-    probe_names[num + EVT_PROBE] = strdup(name);
+    probe_names[num + EVT_PROBE] = intern(name);
 }
 
 void Trace::evt_process_create(uint64_t ts, Thread* t, uint32_t pid) {
@@ -279,7 +397,7 @@ void Trace::evt_process_start(uint64_t ts, Thread* t, uint32_t pid, uint32_t tid
 }
 void Trace::evt_process_name(uint32_t pid, const char* name, uint32_t index) {
     Process* p = find_process(pid);
-    p->group->name = strdup(name);
+    p->group->name = intern(name);
 }
 
 void Trace::evt_thread_create(uint64_t ts, Thread* ct, uint32_t tid, uint32_t pid) {
@@ -300,7 +418,7 @@ void Trace::evt_thread_name(uint32_t tid, uint32_t pid, const char* name) {
     char tmp[128];
     sprintf(tmp, "%s (%u)", name, tid);
     Thread* t = find_thread(tid);
-    t->track->name = strdup(tmp);
+    t->track->name = intern(tmp);
 
     // if thread is not created, it must be already running
     // so we'll create it retroactively
@@ -313,7 +431,7 @@ void Trace::evt_thread_name(uint32_t tid, uint32_t pid, const char* name) {
 
 void Trace::evt_kthread_name(uint32_t tid, const char* name) {
     Thread* t = find_kthread(tid);
-    t->track->name = strdup(name);
+    t->track->name = intern(name);
 }
 
 void Trace::evt_msgpipe_create(uint64_t ts, Thread* t, uint32_t id, uint32_t otherid) {
@@ -483,27 +601,15 @@ void Trace::evt_probe(uint64_t ts, Thread* t, uint32_t evt, uint32_t arg0, uint3
     e->b = arg1;
 }
 
-typedef struct {
-    uint64_t ts_first;
-    uint64_t ts_last;
-    uint32_t events;
-    uint32_t context_switch;
-    uint32_t msgpipe_new;
-    uint32_t msgpipe_del;
-    uint32_t msgpipe_write;
-    uint32_t msgpipe_read;
-    uint32_t thread_new;
-    uint32_t thread_del;
-    uint32_t process_new;
-    uint32_t process_del;
-} stats_t;
-
-void dump_stats(stats_t* s) {
+static void dump_stats(ImportStats* s) {
     fprintf(stderr, "-----------------------------------------\n");
     uint64_t duration = s->ts_last - s->ts_first;
     fprintf(stderr, "elapsed time:     %lu.%06lu s\n",
             duration / 1000000UL, duration % 1000000UL);
     fprintf(stderr, "total events:     %u\n", s->events);
+    if (s->filtered) {
+        fprintf(stderr, "filtered out:     %u\n", s->filtered);
+    }
     fprintf(stderr, "context switches: %u\n", s->context_switch);
     fprintf(stderr, "msgpipe created:  %u\n", s->msgpipe_new);
     fprintf(stderr, "msgpipe deleted:  %u\n", s->msgpipe_del);
@@ -511,11 +617,17 @@ void dump_stats(stats_t* s) {
     fprintf(stderr, "msgpipe reads:    %u\n", s->msgpipe_read);
     fprintf(stderr, "thread created:   %u\n", s->thread_new);
     fprintf(stderr, "process created:  %u\n", s->process_new);
+    if (s->count_ns) {
+        fprintf(stderr, "counting pass:    %lu us\n", s->count_ns / 1000UL);
+    }
+    fprintf(stderr, "import:           %lu us\n", s->import_ns / 1000UL);
 }
 
-static stats_t s;
-
-#define trace(fmt...) do { if(text) fprintf(stderr, fmt); } while (0)
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
 typedef union ktrace_record {
     ktrace_header_t hdr;
@@ -524,10 +636,6 @@ typedef union ktrace_record {
     uint8_t raw[256];
 } ktrace_record_t;
 
-static inline void tracehdr(uint64_t ts, uint32_t id) {
-   trace("%04lu.%09lu [%08x] ", ts/(1000000000UL), ts%(1000000000UL), id);
-}
-
 void Trace::import_event(ktrace_record_t& rec, uint32_t evt) {
     // only valid if the sub-header actually uses this field
     uint64_t ts = ticks_to_ts(rec.hdr.ts);
@@ -535,85 +643,57 @@ void Trace::import_event(ktrace_record_t& rec, uint32_t evt) {
 
     switch (evt) {
     case EVT_VERSION:
-        tracehdr(0, 0);
+        version = rec.x4.a;
         ts_valid = false;
-        trace("VERSION      n=%08x\n", rec.x4.a);
         return;
     case EVT_TICKS_PER_MS:
         ticks_per_ms = ((uint64_t)rec.x4.a) | (((uint64_t)rec.x4.b) << 32);
-        tracehdr(0, 0);
         ts_valid = false;
-        trace("TICKS_PER_MS n=%lu\n", ticks_per_ms);
         return;
     case EVT_CONTEXT_SWITCH:
-        s.context_switch++;
-        tracehdr(ts, rec.hdr.tid);
-        trace("CTXT_SWITCH to=%08x st=%d cpu=%d old=%08x new=%08x\n",
-              rec.x4.a, rec.x4.b >> 16, rec.x4.b & 0xFFFF, rec.x4.c, rec.x4.d);
+        stats.context_switch++;
         evt_context_switch(ts, rec.x4.tid, rec.x4.a, rec.x4.b >> 16, rec.x4.b & 0xFFFF, rec.x4.c, rec.x4.d);
-        s.ts_last = ts;    s.ts_last = ts;
+        stats.ts_last = ts;    stats.ts_last = ts;
         return;
     case EVT_PROC_NAME:
-        tracehdr(0, 0);
         ts_valid = false;
-        trace("PROC_NAME   id=%08x '%s'\n", rec.name.id, recname(rec.name));
         evt_process_name(rec.name.id, recname(rec.name), 10);
         return;
     case EVT_THREAD_NAME:
-        tracehdr(0, 0);
         ts_valid = false;
-        trace("THRD_NAME   id=%08x '%s'\n", rec.name.id, recname(rec.name));
         evt_thread_name(rec.name.id, rec.name.arg, recname(rec.name));
         return;
     case EVT_KTHREAD_NAME:
-        tracehdr(0, 0);
         ts_valid = false;
-        trace("THRD_NAME   id=%08x '%s'\n", rec.name.id, recname(rec.name));
         evt_kthread_name(rec.name.id, recname(rec.name));
         return;
     case EVT_SYSCALL_NAME:
-        tracehdr(0, 0);
         ts_valid = false;
-        trace("SYSCALLNAME id=%08x '%s'\n", rec.name.id, recname(rec.name));
         evt_syscall_name(rec.name.id, recname(rec.name));
         return;
     case EVT_PROBE_NAME:
-        tracehdr(0, 0);
         ts_valid = false;
-        trace("PROBE_NAME id=%08x '%s'\n", rec.name.id, recname(rec.name));
         evt_probe_name(rec.name.id, recname(rec.name));
         return;
     case EVT_IRQ_ENTER:
-        tracehdr(ts, 0);
-        trace("IRQ_ENTER   cpu=%03d irqn=%05d\n", rec.hdr.tid & 0xFF, rec.hdr.tid >> 8);
         evt_irq_enter(ts, rec.hdr.tid & 0xFF, rec.hdr.tid >> 8);
         return;
     case EVT_IRQ_EXIT:
-        tracehdr(ts, 0);
-        trace("IRQ_EXIT   cpu=%03d irqn=%05d\n", rec.hdr.tid & 0xFF, rec.hdr.tid >> 8);
         evt_irq_exit(ts, rec.hdr.tid & 0xFF, rec.hdr.tid >> 8);
         return;
     case EVT_SYSCALL_ENTER:
-        tracehdr(ts, 0);
-        trace("SYSCALL     cpu=%03d n=%05d\n", rec.hdr.tid & 0xFF, rec.hdr.tid >> 8);
         evt_syscall_enter(ts, rec.hdr.tid & 0xFF, rec.hdr.tid >> 8);
         return;
     case EVT_SYSCALL_EXIT:
-        tracehdr(ts, 0);
-        trace("SYSCALL_RET cpu=%03d n=%05d\n", rec.hdr.tid & 0xFF, rec.hdr.tid >> 8);
         evt_syscall_exit(ts, rec.hdr.tid & 0xFF, rec.hdr.tid >> 8);
         return;
     case EVT_PAGE_FAULT: {
-        tracehdr(ts, 0);
         uint64_t address = ((uint64_t)rec.x4.a << 32) | rec.x4.b;
-        trace("PAGE_FAULT address %016lx flags %08x cpu=%03d\n", address, rec.x4.c, rec.x4.d);
         evt_page_fault(ts, address, rec.x4.c, rec.x4.d);
         return;
     }
     case EVT_PAGE_FAULT_EXIT: {
-        tracehdr(ts, 0);
         uint64_t address = ((uint64_t)rec.x4.a << 32) | rec.x4.b;
-        trace("PAGE_FAULT_EXIT address %016lx flags %08x cpu=%03d\n", address, rec.x4.c, rec.x4.d);
         evt_page_fault_exit(ts, address, rec.x4.c, rec.x4.d);
         return;
     }
@@ -621,8 +701,6 @@ void Trace::import_event(ktrace_record_t& rec, uint32_t evt) {
         // events before 0x100 do not have the common tag/tid/ts header
         // so bail here instead of in the later switch
         if (evt < 0x100) {
-            tracehdr(0, 0);
-            trace("UNKNOWN_EVT tag=%08x evt=%03x\n", rec.hdr.tag, evt);
             return;
         }
         break;
@@ -634,25 +712,21 @@ void Trace::import_event(ktrace_record_t& rec, uint32_t evt) {
     }
     Thread* t = find_thread(rec.hdr.tid);
 
-    tracehdr(ts, rec.hdr.tid);
     switch (evt) {
-    case EVT_OBJECT_DELETE:
-        Object* oi;
-        if ((oi = find_object(rec.x4.a, 0)) == 0) {
-            trace("OBJT_DELETE id=%08x\n", rec.x4.a);
-        } else {
-            trace("%s_DELETE id=%08x\n", kind_string(oi->kind), rec.x4.a);
+    case EVT_OBJECT_DELETE: {
+        Object* oi = find_object(rec.x4.a, 0);
+        if (oi != nullptr) {
             switch (oi->kind) {
             case KPIPE:
-                s.msgpipe_del++;
+                stats.msgpipe_del++;
                 evt_msgpipe_delete(ts, t, rec.x4.a);
                 break;
             case KTHREAD:
-                s.thread_del++;
+                stats.thread_del++;
                 evt_thread_delete(ts, t, rec.x4.a);
                 break;
             case KPROC:
-                s.process_del++;
+                stats.process_del++;
                 evt_process_delete(ts, t, rec.x4.a);
                 break;
             case KPORT:
@@ -661,82 +735,67 @@ void Trace::import_event(ktrace_record_t& rec, uint32_t evt) {
             }
         }
         break;
+    }
     case EVT_PROC_CREATE:
-        s.process_new++;
-        trace("PROC_CREATE id=%08x\n", rec.x4.a);
+        stats.process_new++;
         evt_process_create(ts, t, rec.x4.a);
         break;
     case EVT_PROC_START:
-        trace("PROC_START  id=%08x tid=%08x\n", rec.x4.b, rec.x4.a);
         evt_process_start(ts, t, rec.x4.b, rec.x4.a);
         break;
     case EVT_THREAD_CREATE:
-        s.thread_new++;
-        trace("THRD_CREATE id=%08x pid=%08x\n", rec.x4.a, rec.x4.b);
+        stats.thread_new++;
         evt_thread_create(ts, t, rec.x4.a, rec.x4.b);
         break;
     case EVT_THREAD_START:
-        trace("THRD_START  id=%08x\n", rec.x4.a);
         evt_thread_start(ts, t, rec.x4.a);
         break;
     case EVT_CHANNEL_CREATE:
-        s.msgpipe_new += 2;
-        trace("CHAN id=%08x other=%08x flags=%x\n", rec.x4.a, rec.x4.b, rec.x4.c);
+        stats.msgpipe_new += 2;
         evt_msgpipe_create(ts, t, rec.x4.a, rec.x4.b);
         break;
     case EVT_CHANNEL_WRITE:
-        s.msgpipe_write++;
-        trace("CHAN_WRITE  id=%08x bytes=%d handles=%d\n", rec.x4.a, rec.x4.b, rec.x4.c);
+        stats.msgpipe_write++;
         evt_msgpipe_write(ts, t, rec.x4.a, rec.x4.b, rec.x4.c);
         break;
     case EVT_CHANNEL_READ:
-        s.msgpipe_read++;
-        trace("CHAN_READ   id=%08x bytes=%d handles=%d\n", rec.x4.a, rec.x4.b, rec.x4.c);
+        stats.msgpipe_read++;
         evt_msgpipe_read(ts, t, rec.x4.a, rec.x4.b, rec.x4.c);
         break;
     case EVT_PORT_CREATE:
-        trace("PORT_CREATE id=%08x\n", rec.x4.a);
         evt_port_create(ts, t, rec.x4.a);
         break;
     case EVT_PORT_QUEUE:
-        trace("PORT_QUEUE  id=%08x\n", rec.x4.a);
         break;
     case EVT_PORT_WAIT:
-        trace("PORT_WAIT   id=%08x\n", rec.x4.a);
         evt_port_wait(ts, t, rec.x4.a);
         break;
     case EVT_PORT_WAIT_DONE:
-        trace("PORT_WDONE  id=%08x\n", rec.x4.a);
         evt_port_wait_done(ts, t, rec.x4.a);
         break;
     case EVT_WAIT_ONE: {
         uint64_t timeout = ((uint64_t)rec.x4.c) | (((uint64_t)rec.x4.d) << 32);
-        trace("WAIT_ONE    id=%08x signals=%08x timeout=%lu\n", rec.x4.a, rec.x4.b, timeout);
         evt_wait_one(ts, t, rec.x4.a, rec.x4.b, timeout);
         break;
     }
     case EVT_WAIT_ONE_DONE:
-        trace("WAIT_DONE   id=%08x pending=%08x result=%08x\n", rec.x4.a, rec.x4.b, rec.x4.c);
         evt_wait_one_done(ts, t, rec.x4.a, rec.x4.b, rec.x4.c);
         break;
     case EVT_KWAIT_BLOCK: {
         uint64_t wait_queue = ((uint64_t)rec.x4.a << 32) | ((uint64_t)rec.x4.b);
 
-        trace("KWAIT_BLOCK wait=%016lx\n", wait_queue);
         evt_kwait_block(ts, t, wait_queue);
         break;
     }
     case EVT_KWAIT_UNBLOCK: {
         uint64_t wait_queue = ((uint64_t)rec.x4.a << 32) | ((uint64_t)rec.x4.b);
 
-        trace("KWAIT_UNBLOCK wait=%016lx status=%08x\n", wait_queue, rec.x4.c);
         evt_kwait_unblock(ts, t, wait_queue, rec.x4.c);
         break;
     }
     case EVT_KWAIT_WAKE: {
         uint64_t wait_queue = ((uint64_t)rec.x4.a << 32) | ((uint64_t)rec.x4.b);
 
-        trace("KWAIT_WAKE wait=%016lx is mutex %d\n", wait_queue, rec.x4.c);
         evt_kwait_wake(ts, t, wait_queue, rec.x4.c);
         break;
     }
@@ -750,7 +809,6 @@ void Trace::import_event(ktrace_record_t& rec, uint32_t evt) {
                 break;
             }
         }
-        trace("UNKNOWN_EVT id=%08x tag=%08x evt=%03x\n", rec.hdr.tid, rec.hdr.tag, evt);
         break;
     }
 
@@ -760,14 +818,599 @@ void Trace::import_event(ktrace_record_t& rec, uint32_t evt) {
     }
 }
 
-static int show_stats = 0;
-static unsigned limit = 0xFFFFFFFF;
+
+bool RecordFilter::keep(const ktrace_record_t& rec) {
+    if (!active) {
+        return true;
+    }
+    uint32_t evt = KTRACE_EVENT(rec.hdr.tag);
+
+    // metadata, which names what is kept, and what later records need
+    switch (evt) {
+    case EVT_TICKS_PER_MS:
+        ticks_per_ms = ((uint64_t)rec.x4.a) | (((uint64_t)rec.x4.b) << 32);
+        window0 = (opt.window_t0 * ticks_per_ms) / 1000000ULL;
+        window1 = (opt.window_t1 * ticks_per_ms) / 1000000ULL;
+        return true;
+    case EVT_THREAD_NAME:
+        pid_of[rec.name.id] = rec.name.arg;
+        return !by_thread || thread_kept(rec.name.id);
+    case EVT_KTHREAD_NAME:
+        return !by_thread || process_kept(0);
+    case EVT_THREAD_CREATE:
+    case EVT_PROC_START:
+        pid_of[rec.x4.a] = rec.x4.b;
+        break;
+    case EVT_CONTEXT_SWITCH:
+        if ((rec.x4.b & 0xFFFF) < MAXCPU) {
+            running[rec.x4.b & 0xFFFF] = rec.x4.a;
+        }
+        break;
+    default:
+        if (evt < EVT_IRQ_ENTER) {
+            return true;
+        }
+        break;
+    }
+
+    if (base == 0) {
+        base = rec.hdr.ts;
+    }
+    if (opt.group_mask && !(KTRACE_GROUP(rec.hdr.tag) & opt.group_mask)) {
+        return false;
+    }
+
+    // threads and processes are kept whenever they were created, so
+    // the ones in the window still land in their process
+    bool lifecycle = (evt >= EVT_OBJECT_DELETE) && (evt <= EVT_PROC_EXIT);
+    if (opt.window_t1 && !lifecycle && ticks_per_ms) {
+        int64_t at = rec.hdr.ts - base;
+        if ((window0 && (at < window0)) || (at > window1)) {
+            return false;
+        }
+    }
+
+    if (!by_thread) {
+        return true;
+    }
+    switch (evt) {
+    case EVT_CONTEXT_SWITCH:
+        // either side keeps a switch, so a kept thread's track has
+        // both ends of its runs
+        return thread_kept(rec.x4.tid) || thread_kept(rec.x4.a);
+    case EVT_IRQ_ENTER:
+    case EVT_IRQ_EXIT:
+    case EVT_SYSCALL_ENTER:
+    case EVT_SYSCALL_EXIT:
+        return cpu_kept(rec.hdr.tid & 0xFF);
+    case EVT_PAGE_FAULT:
+    case EVT_PAGE_FAULT_EXIT:
+        return cpu_kept(rec.x4.d);
+    case EVT_THREAD_CREATE:
+    case EVT_PROC_START:
+        return thread_kept(rec.x4.a) || thread_kept(rec.hdr.tid);
+    case EVT_PROC_CREATE:
+        return process_kept(rec.x4.a) || thread_kept(rec.hdr.tid);
+    default:
+        return thread_kept(rec.hdr.tid);
+    }
+}
+
+// read the next whole record, false at the end of the trace
+static bool read_record(Reader* r, ktrace_record_t& rec, unsigned& offset, unsigned limit) {
+    if (r->read(rec.raw, sizeof(ktrace_header_t)) != sizeof(ktrace_header_t)) {
+        return false;
+    }
+    uint32_t tag = rec.hdr.tag;
+    uint32_t len = KTRACE_LEN(tag);
+    if (tag == 0) {
+        fprintf(stderr, "eof: zero tag at offset %08x\n", offset);
+        return false;
+    }
+    if (len < sizeof(ktrace_header_t)) {
+        fprintf(stderr, "eof: short packet at offset %08x\n", offset);
+        return false;
+    }
+    offset += (sizeof(ktrace_header_t) + len);
+    len -= sizeof(ktrace_header_t);
+    if (r->read(rec.raw + sizeof(ktrace_header_t), len) != len) {
+        fprintf(stderr, "eof: incomplete packet at offset %08x\n", offset);
+        return false;
+    }
+    return (limit == 0) || (offset <= limit);
+}
+
+void Trace::import_records(Reader* r) {
+    ktrace_record_t rec;
+    unsigned offset = 0;
+    RecordFilter filter(options);
+    this->filter = filter.by_thread ? &filter : nullptr;
+    for (;;) {
+        // when filtering, records whole in the reader's buffer are
+        // copied out in one go rather than through read_record(); the
+        // buffer need not be 8 byte aligned (FdReader hands out the
+        // sniffed magic as a block of its own), so nothing is read from
+        // it in place
+        uint32_t tag = 0;
+        if (filter.active && (r->avail >= sizeof(tag))) {
+            memcpy(&tag, r->cur, sizeof(tag));
+        }
+        uint32_t len = KTRACE_LEN(tag);
+        if ((len >= sizeof(ktrace_header_t)) && (len <= r->avail)) {
+            offset += (sizeof(ktrace_header_t) + len);
+            if (options.limit && (offset > options.limit)) {
+                break;
+            }
+            memcpy(rec.raw, r->cur, len);
+            r->cur += len;
+            r->avail -= len;
+            if (!filter.keep(rec)) {
+                stats.filtered++;
+                continue;
+            }
+        } else if (!read_record(r, rec, offset, options.limit)) {
+            break;
+        } else if (!filter.keep(rec)) {
+            stats.filtered++;
+            continue;
+        }
+        stats.events++;
+        import_event(rec, KTRACE_EVENT(rec.hdr.tag));
+        publish_pending();
+    }
+    this->filter = nullptr;
+}
+
+// The text dump formats each record straight into the Writer's buffer.
+// It shares only the reading and the filters with import_records(), so
+// dumping builds no model and importing formats no text.
+
+// output is handed to write(2) this many bytes at a time
+#define TEXT_DUMP_BUFFER (4 * 1024 * 1024)
+
+template <size_t N>
+static inline void put(Writer& w, const char (&str)[N]) {
+    w.write(str, N - 1);
+}
+
+// as %x
+static void put_hex(Writer& w, uint64_t n) {
+    unsigned digits = 1;
+    while ((digits < 16) && (n >> (digits * 4))) {
+        digits++;
+    }
+    w.hex(n, digits);
+}
+
+static void put_header(Writer& w, uint64_t ts, uint32_t id) {
+    w.dec(ts / 1000000000UL, 4);
+    w.putc('.');
+    w.dec(ts % 1000000000UL, 9);
+    put(w, " [");
+    w.hex(id, 8);
+    put(w, "] ");
+}
+
+static void put_name(Writer& w, ktrace_record_t& rec) {
+    w.hex(rec.name.id, 8);
+    put(w, " '");
+    w.puts(recname(rec.name));
+    put(w, "'\n");
+}
+
+static void put_cpu(Writer& w, uint32_t tid, const char* what) {
+    w.dec(tid & 0xFF, 3);
+    w.puts(what);
+    w.dec(tid >> 8, 5);
+    w.putc('\n');
+}
+
+static void put_fault(Writer& w, ktrace_record_t& rec) {
+    w.hex(((uint64_t)rec.x4.a << 32) | rec.x4.b, 16);
+    put(w, " flags ");
+    w.hex(rec.x4.c, 8);
+    put(w, " cpu=");
+    w.dec(rec.x4.d, 3);
+    w.putc('\n');
+}
+
+static void dump_record(Writer& w, ktrace_record_t& rec, uint32_t evt, uint64_t ts) {
+    switch (evt) {
+    case EVT_VERSION:
+        put_header(w, 0, 0);
+        put(w, "VERSION      n=");
+        w.hex(rec.x4.a, 8);
+        w.putc('\n');
+        return;
+    case EVT_TICKS_PER_MS:
+        put_header(w, 0, 0);
+        put(w, "TICKS_PER_MS n=");
+        w.dec(((uint64_t)rec.x4.a) | (((uint64_t)rec.x4.b) << 32));
+        w.putc('\n');
+        return;
+    case EVT_CONTEXT_SWITCH:
+        put_header(w, ts, rec.hdr.tid);
+        put(w, "CTXT_SWITCH to=");
+        w.hex(rec.x4.a, 8);
+        put(w, " st=");
+        w.dec(rec.x4.b >> 16);
+        put(w, " cpu=");
+        w.dec(rec.x4.b & 0xFFFF);
+        put(w, " old=");
+        w.hex(rec.x4.c, 8);
+        put(w, " new=");
+        w.hex(rec.x4.d, 8);
+        w.putc('\n');
+        return;
+    case EVT_PROC_NAME:
+        put_header(w, 0, 0);
+        put(w, "PROC_NAME   id=");
+        put_name(w, rec);
+        return;
+    case EVT_THREAD_NAME:
+    case EVT_KTHREAD_NAME:
+        put_header(w, 0, 0);
+        put(w, "THRD_NAME   id=");
+        put_name(w, rec);
+        return;
+    case EVT_SYSCALL_NAME:
+        put_header(w, 0, 0);
+        put(w, "SYSCALLNAME id=");
+        put_name(w, rec);
+        return;
+    case EVT_PROBE_NAME:
+        put_header(w, 0, 0);
+        put(w, "PROBE_NAME id=");
+        put_name(w, rec);
+        return;
+    case EVT_IRQ_ENTER:
+        put_header(w, ts, 0);
+        put(w, "IRQ_ENTER   cpu=");
+        put_cpu(w, rec.hdr.tid, " irqn=");
+        return;
+    case EVT_IRQ_EXIT:
+        put_header(w, ts, 0);
+        put(w, "IRQ_EXIT   cpu=");
+        put_cpu(w, rec.hdr.tid, " irqn=");
+        return;
+    case EVT_SYSCALL_ENTER:
+        put_header(w, ts, 0);
+        put(w, "SYSCALL     cpu=");
+        put_cpu(w, rec.hdr.tid, " n=");
+        return;
+    case EVT_SYSCALL_EXIT:
+        put_header(w, ts, 0);
+        put(w, "SYSCALL_RET cpu=");
+        put_cpu(w, rec.hdr.tid, " n=");
+        return;
+    case EVT_PAGE_FAULT:
+        put_header(w, ts, 0);
+        put(w, "PAGE_FAULT address ");
+        put_fault(w, rec);
+        return;
+    case EVT_PAGE_FAULT_EXIT:
+        put_header(w, ts, 0);
+        put(w, "PAGE_FAULT_EXIT address ");
+        put_fault(w, rec);
+        return;
+    default:
+        if (evt < 0x100) {
+            put_header(w, 0, 0);
+            put(w, "UNKNOWN_EVT tag=");
+            w.hex(rec.hdr.tag, 8);
+            put(w, " evt=");
+            w.hex(evt, 3);
+            w.putc('\n');
+            return;
+        }
+        break;
+    }
+
+    put_header(w, ts, rec.hdr.tid);
+    switch (evt) {
+    case EVT_OBJECT_DELETE:
+        put(w, "OBJT_DELETE id=");
+        w.hex(rec.x4.a, 8);
+        break;
+    case EVT_PROC_CREATE:
+        put(w, "PROC_CREATE id=");
+        w.hex(rec.x4.a, 8);
+        break;
+    case EVT_PROC_START:
+        put(w, "PROC_START  id=");
+        w.hex(rec.x4.b, 8);
+        put(w, " tid=");
+        w.hex(rec.x4.a, 8);
+        break;
+    case EVT_THREAD_CREATE:
+        put(w, "THRD_CREATE id=");
+        w.hex(rec.x4.a, 8);
+        put(w, " pid=");
+        w.hex(rec.x4.b, 8);
+        break;
+    case EVT_THREAD_START:
+        put(w, "THRD_START  id=");
+        w.hex(rec.x4.a, 8);
+        break;
+    case EVT_CHANNEL_CREATE:
+        put(w, "CHAN id=");
+        w.hex(rec.x4.a, 8);
+        put(w, " other=");
+        w.hex(rec.x4.b, 8);
+        put(w, " flags=");
+        put_hex(w, rec.x4.c);
+        break;
+    case EVT_CHANNEL_WRITE:
+    case EVT_CHANNEL_READ:
+        if (evt == EVT_CHANNEL_WRITE) {
+            put(w, "CHAN_WRITE  id=");
+        } else {
+            put(w, "CHAN_READ   id=");
+        }
+        w.hex(rec.x4.a, 8);
+        put(w, " bytes=");
+        w.dec(rec.x4.b);
+        put(w, " handles=");
+        w.dec(rec.x4.c);
+        break;
+    case EVT_PORT_CREATE:
+        put(w, "PORT_CREATE id=");
+        w.hex(rec.x4.a, 8);
+        break;
+    case EVT_PORT_QUEUE:
+        put(w, "PORT_QUEUE  id=");
+        w.hex(rec.x4.a, 8);
+        break;
+    case EVT_PORT_WAIT:
+        put(w, "PORT_WAIT   id=");
+        w.hex(rec.x4.a, 8);
+        break;
+    case EVT_PORT_WAIT_DONE:
+        put(w, "PORT_WDONE  id=");
+        w.hex(rec.x4.a, 8);
+        break;
+    case EVT_WAIT_ONE:
+        put(w, "WAIT_ONE    id=");
+        w.hex(rec.x4.a, 8);
+        put(w, " signals=");
+        w.hex(rec.x4.b, 8);
+        put(w, " timeout=");
+        w.dec(((uint64_t)rec.x4.c) | (((uint64_t)rec.x4.d) << 32));
+        break;
+    case EVT_WAIT_ONE_DONE:
+        put(w, "WAIT_DONE   id=");
+        w.hex(rec.x4.a, 8);
+        put(w, " pending=");
+        w.hex(rec.x4.b, 8);
+        put(w, " result=");
+        w.hex(rec.x4.c, 8);
+        break;
+    case EVT_KWAIT_BLOCK:
+        put(w, "KWAIT_BLOCK wait=");
+        w.hex(((uint64_t)rec.x4.a << 32) | rec.x4.b, 16);
+        break;
+    case EVT_KWAIT_UNBLOCK:
+        put(w, "KWAIT_UNBLOCK wait=");
+        w.hex(((uint64_t)rec.x4.a << 32) | rec.x4.b, 16);
+        put(w, " status=");
+        w.hex(rec.x4.c, 8);
+        break;
+    case EVT_KWAIT_WAKE:
+        put(w, "KWAIT_WAKE wait=");
+        w.hex(((uint64_t)rec.x4.a << 32) | rec.x4.b, 16);
+        put(w, " is mutex ");
+        w.dec(rec.x4.c);
+        break;
+    default:
+        if ((evt >= EVT_PROBE) && ((KTRACE_LEN(rec.hdr.tag) == 16) ||
+                                   (KTRACE_LEN(rec.hdr.tag) == 24))) {
+            put(w, "PROBE       n=");
+            w.hex(evt - EVT_PROBE, 3);
+            if (KTRACE_LEN(rec.hdr.tag) == 24) {
+                put(w, " a=");
+                w.hex(rec.x4.a, 8);
+                put(w, " b=");
+                w.hex(rec.x4.b, 8);
+            }
+            break;
+        }
+        put(w, "UNKNOWN_EVT id=");
+        w.hex(rec.hdr.tid, 8);
+        put(w, " tag=");
+        w.hex(rec.hdr.tag, 8);
+        put(w, " evt=");
+        w.hex(evt, 3);
+        break;
+    }
+    w.putc('\n');
+}
+
+static int dump_records(int fd, const ImportOptions& opt, Writer& w) {
+    uint32_t magic;
+    if ((pread(fd, &magic, sizeof(magic), 0) == sizeof(magic)) && (magic == TVZ_MAGIC)) {
+        fprintf(stderr, "error: only ktrace files can be dumped as text\n");
+        return -1;
+    }
+    Reader* r = reader_open(fd);
+    if (r == nullptr) {
+        return -1;
+    }
+    uint64_t t0 = now_ns();
+    ktrace_record_t rec;
+    unsigned offset = 0;
+    unsigned count = 0;
+    unsigned filtered = 0;
+    uint64_t ticks_per_ms = 0;
+    RecordFilter filter(opt);
+    while (read_record(r, rec, offset, opt.limit)) {
+        if (!filter.keep(rec)) {
+            filtered++;
+            continue;
+        }
+        uint32_t evt = KTRACE_EVENT(rec.hdr.tag);
+        if (evt == EVT_TICKS_PER_MS) {
+            ticks_per_ms = ((uint64_t)rec.x4.a) | (((uint64_t)rec.x4.b) << 32);
+        }
+        // only valid if the sub-header actually uses this field
+        uint64_t ts = ticks_per_ms ? ((rec.hdr.ts * 1000000ULL) / ticks_per_ms) : 0;
+        dump_record(w, rec, evt, ts);
+        count++;
+    }
+    delete r;
+    int status = w.flush();
+    if (opt.show_stats) {
+        fprintf(stderr, "records dumped:   %u\n", count);
+        if (filtered) {
+            fprintf(stderr, "filtered out:     %u\n", filtered);
+        }
+        fprintf(stderr, "dump:             %lu us\n", (now_ns() - t0) / 1000UL);
+    }
+    return status;
+}
+
+// write the records of the trace at path as text to opt.text_path, or
+// to stdout for "-"
+int dump_text(const char* path, const ImportOptions& opt) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error: cannot open '%s'\n", path);
+        return -1;
+    }
+    bool to_stdout = !strcmp(opt.text_path, "-");
+    int out = to_stdout ? STDOUT_FILENO : open(opt.text_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        fprintf(stderr, "error: cannot create '%s'\n", opt.text_path);
+        close(fd);
+        return -1;
+    }
+    Writer w(out, TEXT_DUMP_BUFFER);
+    int r = dump_records(fd, opt, w);
+    if (!to_stdout && (w.close() < 0)) {
+        r = -1;
+    }
+    if (w.error) {
+        fprintf(stderr, "error: failed writing '%s'\n", to_stdout ? "stdout" : opt.text_path);
+    }
+    close(fd);
+    return r;
+}
+
+static inline uint64_t thread_key(uint32_t tid, uint32_t kthread) {
+    return tid ? tid : ((1ULL << 32) | kthread);
+}
+
+// The first of two passes: count what each thread's track will hold
+// without creating any objects. Mirrors import_event(), including
+// which thread is running on each cpu, closely enough to size tracks;
+// a short count only means the track grows past its reserved chunk.
+void Trace::count_records(Reader* r) {
+    ktrace_record_t buf;
+    unsigned offset = 0;
+    uint64_t running[MAXCPU];
+    memset(running, 0, sizeof(running));
+    RecordFilter filter(options);
+
+    // consecutive records are often from the same thread
+    uint64_t lastkey = 0;
+    TrackCount* last = nullptr;
+    auto count = [&](uint64_t key) -> TrackCount& {
+        if ((key != lastkey) || (last == nullptr)) {
+            lastkey = key;
+            last = &track_counts[key];
+        }
+        return *last;
+    };
+
+    for (;;) {
+        // records whole in the reader's buffer are looked at in place,
+        // anything else (including bad ones) goes through read_record()
+        const ktrace_record_t* p = (const ktrace_record_t*) r->cur;
+        uint32_t len = (r->avail >= sizeof(ktrace_header_t)) ? KTRACE_LEN(p->hdr.tag) : 0;
+        if ((len >= sizeof(ktrace_header_t)) && (len <= r->avail)) {
+            offset += (sizeof(ktrace_header_t) + len);
+            if (options.limit && (offset > options.limit)) {
+                break;
+            }
+            r->cur += len;
+            r->avail -= len;
+        } else if (read_record(r, buf, offset, options.limit)) {
+            p = &buf;
+        } else {
+            break;
+        }
+        const ktrace_record_t& rec = *p;
+        if (!filter.keep(rec)) {
+            continue;
+        }
+
+        uint32_t evt = KTRACE_EVENT(rec.hdr.tag);
+        uint32_t cpu;
+        switch (evt) {
+        case EVT_CONTEXT_SWITCH: {
+            uint64_t newkey = thread_key(rec.x4.a, rec.x4.d);
+            count(thread_key(rec.x4.tid, rec.x4.c)).tasks++;
+            count(newkey).tasks++;
+            cpu = rec.x4.b & 0xFFFF;
+            if (cpu < MAXCPU) {
+                running[cpu] = newkey;
+            }
+            continue;
+        }
+        case EVT_IRQ_ENTER:
+        case EVT_IRQ_EXIT:
+        case EVT_SYSCALL_ENTER:
+        case EVT_SYSCALL_EXIT:
+            cpu = rec.hdr.tid & 0xFF;
+            if ((cpu < MAXCPU) && running[cpu]) {
+                count(running[cpu]).events++;
+            }
+            continue;
+        case EVT_PAGE_FAULT:
+        case EVT_PAGE_FAULT_EXIT:
+            cpu = rec.x4.d;
+            if ((cpu < MAXCPU) && running[cpu]) {
+                count(running[cpu]).events++;
+            }
+            continue;
+        case EVT_CHANNEL_CREATE:
+        case EVT_CHANNEL_WRITE:
+        case EVT_CHANNEL_READ:
+        case EVT_PORT_WAIT:
+        case EVT_PORT_WAIT_DONE:
+        case EVT_WAIT_ONE:
+        case EVT_WAIT_ONE_DONE:
+        case EVT_KWAIT_BLOCK:
+        case EVT_KWAIT_UNBLOCK:
+        case EVT_KWAIT_WAKE:
+            break;
+        default:
+            if ((evt < EVT_PROBE) ||
+                ((KTRACE_LEN(rec.hdr.tag) != 16) && (KTRACE_LEN(rec.hdr.tag) != 24))) {
+                continue;
+            }
+            break;
+        }
+        if (rec.hdr.tid != 0) {
+            count(rec.hdr.tid).events++;
+        }
+    }
+}
+
+// give a new thread's track the size counted for it, plus the final
+// task state added by Thread::finish()
+void Trace::track_reserve(Track* t, uint64_t key) {
+    auto it = track_counts.find(key);
+    if (it != track_counts.end()) {
+        t->task.reserve(it->second.tasks + 1);
+        t->event.reserve(it->second.events);
+    }
+}
 
 void adjust_tracks(Group* groups) {
     int64_t tszero = 0x7FFFFFFFFFFFFFFFUL;
     for (Group* g = groups; g != NULL; g = g->next) {
         for (Track* t = g->first; t != NULL; t = t->next) {
-            if (t->task[1].ts < tszero) {
+            if ((t->task.size() > 1) && (t->task[1].ts < tszero)) {
                 tszero = t->task[1].ts;
             }
         }
@@ -784,39 +1427,64 @@ void adjust_tracks(Group* groups) {
     }
 }
 
+static void prune_groups(Trace& trace) {
+    Group* last = nullptr;
+    for (Group* g = trace.group_list; g != nullptr; g = g->next) {
+        if (g->first == nullptr) {
+            continue;
+        }
+        if (last == nullptr) {
+            trace.group_list = g;
+        } else {
+            last->next = g;
+        }
+        last = g;
+    }
+    if (last == nullptr) {
+        trace.group_list = nullptr;
+    } else {
+        last->next = nullptr;
+    }
+    trace.group_last = last;
+}
+
 int Trace::import(int fd) {
-    ktrace_record_t rec;
-    unsigned offset = 0;
-    memset(&s, 0, sizeof(s));
+    memset(&stats, 0, sizeof(stats));
 
-    evt_process_name(0, "Magenta Kernel", 0);
+    uint32_t magic;
+    if ((pread(fd, &magic, sizeof(magic), 0) == sizeof(magic)) && (magic == TVZ_MAGIC)) {
+        return import_native(fd);
+    }
 
-    while (read(fd, rec.raw, sizeof(ktrace_header_t)) == sizeof(ktrace_header_t)) {
-        uint32_t tag = rec.hdr.tag;
-        uint32_t len = KTRACE_LEN(tag);
-        if (tag == 0) {
-            fprintf(stderr, "eof: zero tag at offset %08x\n", offset);
-            break;
-        }
-        if (len < sizeof(ktrace_header_t)) {
-            fprintf(stderr, "eof: short packet at offset %08x\n", offset);
-            break;
-        }
-        offset += (sizeof(ktrace_header_t) + len);
-        len -= sizeof(ktrace_header_t);
-        if (read(fd, rec.raw + sizeof(ktrace_header_t), len) != len) {
-            fprintf(stderr, "eof: incomplete packet at offset %08x\n", offset);
-            break;
-        }
-        if (offset > limit) {
-            break;
-        }
+    // counting first lets every track be allocated once, at the cost
+    // of reading the input twice, so only for mappable input
+    uint64_t t0 = now_ns();
+    Reader* r = nullptr;
+    if (options.two_pass && ((r = reader_map(fd)) != nullptr)) {
+        count_records(r);
+        delete r;
+        stats.count_ns = now_ns() - t0;
+        r = reader_map(fd);
+    }
+    if ((r == nullptr) && ((r = reader_open(fd)) == nullptr)) {
+        return -1;
+    }
 
-        s.events++;
-        import_event(rec, KTRACE_EVENT(tag));
+    evt_process_name(0, "Magenta Kernel", 0);
+    import_records(r);
+    delete r;
+    track_counts.clear();
+    stats.import_ns = now_ns() - t0;
+
+    // every ktrace starts with a version record; without one this is
+    // some other file, and there is nothing to show
+    if (version == 0) {
+        fprintf(stderr, "error: not a ktrace file\n");
+        return -1;
     }
-    if (s.events) {
-        finish(s.ts_last);
+
+    if (stats.events) {
+        finish(stats.ts_last);
         adjust_tracks(group_list);
     }
 
@@ -827,7 +1495,7 @@ int Trace::import(int fd) {
     Track* next;
     for (Track* t = k->first; t != nullptr; t = next) {
         next = t->next;
-        if (!strncmp(t->name, "idle", 4)) {
+        if (is_idle_track(t)) {
             if (last == nullptr) {
                 t->next = nullptr;
                 first = last = t;
@@ -848,39 +1516,195 @@ int Trace::import(int fd) {
     k->first = first;
     k->last = last;
 
-    if (show_stats) {
-        dump_stats(&s);
+    // processes filtered out leave groups without tracks behind
+    if (options.pid_count || options.tid_count) {
+        prune_groups(*this);
+    }
+
+    build_indexes();
+
+    if (options.show_stats) {
+        dump_stats(&stats);
     }
     return 0;
 }
 
-int Trace::import(int argc, char** argv) {
-    while (argc > 1) {
-        if (!strcmp(argv[1], "-v")) {
-            verbose++;
-        } else if (!strcmp(argv[1], "-text")) {
-            text = 1;
-        } else if (!strncmp(argv[1], "-limit=", 7)) {
-            limit = 32 * atoi(argv[1] + 7);
-        } else if (!strcmp(argv[1], "-stats")) {
-            show_stats = 1;
-        } else if (argv[1][0] == '-') {
-            fprintf(stderr, "error: unknown option '%s'\n\n", argv[0]);
+// derived data shared by every import path
+void Trace::build_indexes(void) {
+    // a paged native file brings its summaries with it; indexing its
+    // events would read the whole file, and keep memory for every event
+    if (pager != nullptr) {
+        probes.spans.assign(tracks.size(), std::vector<ProbeSpan>());
+        probes.longest.assign(tracks.size(), 0);
+        residency.tracks.assign(tracks.size(), std::vector<ResidencyKey>());
+        return;
+    }
+    waitqs.build(*this);
+    build_tag_index();
+    probes.build(*this);
+    unsigned nthreads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    residency.build(*this, std::max(nthreads, 1u));
+    build_counters();
+    task_lod.build(*this);
+    overview.build(*this);
+}
+
+// -pair=begin,end with two probe numbers pairs those probes, otherwise
+// begin and end are name patterns
+static bool parse_probe_rule(char* arg, ImportOptions& opt) {
+    char* comma = strchr(arg, ',');
+    if ((comma == nullptr) || (comma == arg) || (comma[1] == 0) ||
+        (opt.probe_rule_count == MAX_PROBE_RULES)) {
+        return false;
+    }
+    *comma = 0;
+    ProbePairRule& r = opt.probe_rules[opt.probe_rule_count++];
+    char* end0;
+    char* end1;
+    r.begin_num = strtoul(arg, &end0, 0);
+    r.end_num = strtoul(comma + 1, &end1, 0);
+    if ((*end0 == 0) && (*end1 == 0)) {
+        r.begin = nullptr;
+        r.end = nullptr;
+    } else {
+        r.begin = arg;
+        r.end = comma + 1;
+    }
+    return true;
+}
+
+// -groups=<mask> takes a number or a list of group names
+static bool parse_groups(char* arg, uint32_t& mask) {
+    static const struct {
+        const char* name;
+        uint32_t grp;
+    } groups[] = {
+        { "meta", KTRACE_GRP_META },
+        { "lifecycle", KTRACE_GRP_LIFECYCLE },
+        { "sched", KTRACE_GRP_SCHEDULER },
+        { "tasks", KTRACE_GRP_TASKS },
+        { "ipc", KTRACE_GRP_IPC },
+    };
+    mask = 0;
+    for (char* name = strtok(arg, ","); name != nullptr; name = strtok(nullptr, ",")) {
+        char* end;
+        uint32_t n = strtoul(name, &end, 0);
+        if ((end != name) && (*end == 0)) {
+            mask |= n;
+            continue;
+        }
+        unsigned i;
+        for (i = 0; i < (sizeof(groups) / sizeof(groups[0])); i++) {
+            if (!strcmp(name, groups[i].name)) {
+                mask |= groups[i].grp;
+                break;
+            }
+        }
+        if (i == (sizeof(groups) / sizeof(groups[0]))) {
+            return false;
+        }
+    }
+    return mask != 0;
+}
+
+// -pid= and -tid= take a comma separated list
+static bool parse_ids(char* arg, uint32_t* ids, unsigned& count) {
+    for (char* id = strtok(arg, ","); id != nullptr; id = strtok(nullptr, ",")) {
+        char* end;
+        uint32_t n = strtoul(id, &end, 0);
+        if ((end == id) || (*end != 0) || (count == MAX_FILTER_IDS)) {
+            return false;
+        }
+        ids[count++] = n;
+    }
+    return count != 0;
+}
+
+// -window=<t0>,<t1> in seconds from the start of the trace
+static bool parse_window(char* arg, ImportOptions& opt) {
+    char* end;
+    double t0 = strtod(arg, &end);
+    if ((end == arg) || (*end != ',')) {
+        return false;
+    }
+    char* t1s = end + 1;
+    double t1 = strtod(t1s, &end);
+    if ((end == t1s) || (*end != 0) || (t0 < 0) || (t1 <= t0)) {
+        return false;
+    }
+    opt.window_t0 = (int64_t) (t0 * 1000000000.0);
+    opt.window_t1 = (int64_t) (t1 * 1000000000.0);
+    return true;
+}
+
+int parse_import_options(int argc, char** argv, ImportOptions& opt) {
+    int n;
+    for (n = 1; n < argc; n++) {
+        if (!strcmp(argv[n], "-v")) {
+            opt.verbose++;
+        } else if (!strcmp(argv[n], "-text")) {
+            opt.text_path = "-";
+        } else if (!strncmp(argv[n], "-text=", 6)) {
+            opt.text_path = argv[n] + 6;
+        } else if (!strncmp(argv[n], "-limit=", 7)) {
+            opt.limit = 32 * atoi(argv[n] + 7);
+        } else if (!strcmp(argv[n], "-stats")) {
+            opt.show_stats = 1;
+        } else if (!strncmp(argv[n], "-export=", 8)) {
+            opt.export_path = argv[n] + 8;
+        } else if (!strcmp(argv[n], "-twopass")) {
+            opt.two_pass = 1;
+        } else if (!strncmp(argv[n], "-budget=", 8)) {
+            opt.page_budget = ((size_t) atoi(argv[n] + 8)) << 20;
+        } else if (!strncmp(argv[n], "-pair=", 6)) {
+            if (!parse_probe_rule(argv[n] + 6, opt)) {
+                fprintf(stderr, "error: bad probe pair '%s'\n\n", argv[n] + 6);
+                return -1;
+            }
+        } else if (!strncmp(argv[n], "-groups=", 8)) {
+            if (!parse_groups(argv[n] + 8, opt.group_mask)) {
+                fprintf(stderr, "error: bad group mask '%s'\n\n", argv[n] + 8);
+                return -1;
+            }
+        } else if (!strncmp(argv[n], "-pid=", 5)) {
+            if (!parse_ids(argv[n] + 5, opt.pids, opt.pid_count)) {
+                fprintf(stderr, "error: bad pid list '%s'\n\n", argv[n] + 5);
+                return -1;
+            }
+        } else if (!strncmp(argv[n], "-tid=", 5)) {
+            if (!parse_ids(argv[n] + 5, opt.tids, opt.tid_count)) {
+                fprintf(stderr, "error: bad tid list '%s'\n\n", argv[n] + 5);
+                return -1;
+            }
+        } else if (!strncmp(argv[n], "-window=", 8)) {
+            if (!parse_window(argv[n] + 8, opt)) {
+                fprintf(stderr, "error: bad time window '%s'\n\n", argv[n] + 8);
+                return -1;
+            }
+        } else if (argv[n][0] == '-') {
+            fprintf(stderr, "error: unknown option '%s'\n\n", argv[n]);
             return -1;
         } else {
             break;
         }
-        argc--;
-        argv++;
     }
+    return n;
+}
 
-    if (argc != 2) {
+int Trace::import(int argc, char** argv) {
+    int n = parse_import_options(argc, argv, options);
+    if ((n < 0) || (n != (argc - 1))) {
         return -1;
     }
+    return import(argv[n]);
+}
+
+int Trace::import(const char* path) {
+    source = path;
 
     int fd;
-    if ((fd = open(argv[1], O_RDONLY)) < 0) {
-        fprintf(stderr, "error: cannot open '%s'\n", argv[0]);
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        fprintf(stderr, "error: cannot open '%s'\n", path);
         return -1;
     }
     int r = import(fd);
@@ -888,4 +1712,30 @@ int Trace::import(int argc, char** argv) {
     return r;
 }
 
+bool is_trace_file(const char* path) {
+    int fd;
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return false;
+    }
+    uint32_t tag = 0;
+    bool ok = (pread(fd, &tag, sizeof(tag), 0) == sizeof(tag));
+    close(fd);
+    return ok && ((tag == TVZ_MAGIC) || reader_compressed(tag) ||
+                  ((KTRACE_EVENT(tag) == EVT_VERSION) && (KTRACE_LEN(tag) == 32)));
+}
+
+const char* Trace::intern(const char* name) {
+    static NamePool& shared = *new NamePool;
+    return (names ? names : &shared)->intern(name);
+}
+
+const char* NamePool::intern(const char* name) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto r = names.insert(name);
+    if (r.second) {
+        bytes += r.first->size() + 1;
+    }
+    return r.first->c_str();
+}
+
 };
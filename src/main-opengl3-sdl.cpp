@@ -12,10 +12,16 @@
 #include <SDL.h>
 
 #include "traceviz.h"
+#include "gltracks.h"
 
 extern ImFont* symbols;
 
 int main(int argc, char** argv) {
+    int r = traceviz_headless(argc, argv);
+    if (r >= 0) {
+        return r;
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_TIMER) != 0) {
         printf("error: %s\n", SDL_GetError());
         return -1;
@@ -38,6 +44,12 @@ int main(int argc, char** argv) {
 
     ImGui_ImplSdlGL3_Init(window);
 
+    // task states are drawn on the GPU when the shaders build
+    static GLTrackRenderer gl_tracks;
+    if (gl_tracks.init()) {
+        traceviz_set_track_renderer(&gl_tracks);
+    }
+
     if (traceviz_main(argc, argv)) {
         return -1;
     }
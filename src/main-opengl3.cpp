@@ -14,12 +14,18 @@
 #include <GLFW/glfw3.h>
 
 #include "traceviz.h"
+#include "gltracks.h"
 
 static void glfw_error(int error, const char* msg) {
     fprintf(stderr, "error: %d: %s\n", error, msg);
 }
 
 int main(int argc, char** argv) {
+    int r = traceviz_headless(argc, argv);
+    if (r >= 0) {
+        return r;
+    }
+
     glfwSetErrorCallback(glfw_error);
 
     if (!glfwInit()) {
@@ -38,6 +44,12 @@ int main(int argc, char** argv) {
 
     ImGui_ImplGlfwGL3_Init(window, true);
 
+    // task states are drawn on the GPU when the shaders build
+    static GLTrackRenderer gl_tracks;
+    if (gl_tracks.init()) {
+        traceviz_set_track_renderer(&gl_tracks);
+    }
+
     if (traceviz_main(argc, argv)) {
         return -1;
     }
@@ -0,0 +1,840 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// for pread
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "native.h"
+#include "writer.h"
+
+namespace tv {
+
+// little endian varint / zigzag encoding
+struct Packer {
+    std::vector<uint8_t> buf;
+
+    void clear() {
+        buf.clear();
+    }
+    void u8(uint8_t n) {
+        buf.push_back(n);
+    }
+    void u32(uint32_t n) {
+        for (unsigned i = 0; i < 4; i++) {
+            buf.push_back(n >> (i * 8));
+        }
+    }
+    void u64(uint64_t n) {
+        for (unsigned i = 0; i < 8; i++) {
+            buf.push_back(n >> (i * 8));
+        }
+    }
+    void varint(uint64_t n) {
+        while (n >= 0x80) {
+            buf.push_back((n & 0x7F) | 0x80);
+            n >>= 7;
+        }
+        buf.push_back(n);
+    }
+    void svarint(int64_t n) {
+        varint((((uint64_t) n) << 1) ^ (uint64_t)(n >> 63));
+    }
+    void f32(float f) {
+        uint32_t n;
+        memcpy(&n, &f, sizeof(n));
+        u32(n);
+    }
+    void str(const char* s) {
+        size_t len = strlen(s);
+        varint(len);
+        buf.insert(buf.end(), s, s + len);
+    }
+};
+
+struct Unpacker {
+    const uint8_t* ptr;
+    const uint8_t* end;
+    bool error;
+
+    Unpacker(const uint8_t* data, size_t len) : ptr(data), end(data + len), error(false) {}
+
+    uint8_t u8() {
+        if (ptr >= end) {
+            error = true;
+            return 0;
+        }
+        return *ptr++;
+    }
+    uint64_t u64() {
+        uint64_t n = 0;
+        for (unsigned i = 0; i < 8; i++) {
+            n |= ((uint64_t) u8()) << (i * 8);
+        }
+        return n;
+    }
+    uint32_t u32() {
+        uint32_t n = 0;
+        for (unsigned i = 0; i < 4; i++) {
+            n |= ((uint32_t) u8()) << (i * 8);
+        }
+        return n;
+    }
+    uint64_t varint() {
+        uint64_t n = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            uint8_t b = u8();
+            n |= ((uint64_t)(b & 0x7F)) << shift;
+            if (!(b & 0x80)) {
+                return n;
+            }
+        }
+        error = true;
+        return 0;
+    }
+    int64_t svarint() {
+        uint64_t n = varint();
+        return (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+    }
+    float f32() {
+        uint32_t n = u32();
+        float f;
+        memcpy(&f, &n, sizeof(f));
+        return f;
+    }
+    // names are interned in the trace's name pool
+    const char* str(Trace& trace) {
+        uint64_t len = varint();
+        if (error || (len > (uint64_t)(end - ptr))) {
+            error = true;
+            return "";
+        }
+        std::string s((const char*) ptr, len);
+        ptr += len;
+        return trace.intern(s.c_str());
+    }
+};
+
+// ---- writing ----
+
+// tasks [ti,tn) and events [ei,en) of track t
+static void encode_segment(Packer& p, int64_t t0, Track* t,
+                           size_t ti, size_t tn, size_t ei, size_t en) {
+    int64_t prev = t0;
+    for (size_t n = ti; n < tn; n++) {
+        p.svarint(t->task[n].ts - prev);
+        prev = t->task[n].ts;
+    }
+    for (size_t n = ti; n < tn; n++) p.u8(t->task[n].state);
+    for (size_t n = ti; n < tn; n++) p.u8(t->task[n].cpu);
+
+    prev = t0;
+    for (size_t n = ei; n < en; n++) {
+        p.svarint(t->event[n].ts - prev);
+        prev = t->event[n].ts;
+    }
+    for (size_t n = ei; n < en; n++) p.varint(t->event[n].tag);
+    for (size_t n = ei; n < en; n++) p.varint(t->event[n].trackidx);
+    for (size_t n = ei; n < en; n++) p.varint(t->event[n].eventidx);
+    for (size_t n = ei; n < en; n++) p.varint(t->event[n].a);
+    for (size_t n = ei; n < en; n++) p.varint(t->event[n].b);
+    for (size_t n = ei; n < en; n++) p.varint(t->event[n].c);
+    for (size_t n = ei; n < en; n++) p.varint(t->event[n].d);
+}
+
+static void write_names(Packer& p, std::map<uint32_t,const char*>& names) {
+    p.varint(names.size());
+    for (auto& n : names) {
+        p.varint(n.first);
+        p.str(n.second ? n.second : "");
+    }
+}
+
+// What the timeline draws zoomed out, so a paged file can be shown
+// whole without reading its blocks. Task state levels too fine to be
+// worth their size are left out (see TVZ_LOD_MAX_RUNS).
+static void write_summaries(Packer& p, Trace& trace) {
+    p.svarint(trace.residency.tmin);
+    p.svarint(trace.residency.tmax);
+
+    const Overview& ov = trace.overview;
+    p.svarint(ov.t0);
+    p.svarint(ov.t1);
+    p.varint(ov.busy.size());
+    for (size_t n = 0; n < ov.busy.size(); n++) {
+        p.f32(ov.busy[n]);
+        p.varint(ov.events[n]);
+    }
+
+    p.varint(trace.counters.size());
+    for (const Counter& c : trace.counters) {
+        // the reader rebuilds the coarser levels from the saved one
+        unsigned level = 0;
+        while (((level + 1) < c.min.size()) && (c.min[level].size() > TVZ_COUNTER_MAX_BUCKETS)) {
+            level++;
+        }
+        p.str(c.name);
+        p.svarint(c.t0);
+        p.varint(c.width << level);
+        p.varint(c.min[level].size());
+        for (size_t n = 0; n < c.min[level].size(); n++) {
+            p.f32(c.min[level][n]);
+            p.f32(c.max[level][n]);
+        }
+    }
+
+    const TaskLod& lod = trace.task_lod;
+    p.svarint(lod.t0);
+    for (size_t idx = 0; idx < lod.levels.size(); idx++) {
+        unsigned first = 0;
+        while ((first < lod.levels[idx].size()) &&
+               (lod.levels[idx][first].runs.size() > TVZ_LOD_MAX_RUNS)) {
+            first++;
+        }
+        if (first == lod.levels[idx].size()) {
+            continue;
+        }
+        p.varint(idx + 1);
+        p.varint(lod.levels[idx].size() - first);
+        for (unsigned n = first; n < lod.levels[idx].size(); n++) {
+            const TaskLodLevel& level = lod.levels[idx][n];
+            p.varint(level.width);
+            p.varint(level.runs.size());
+            int64_t prev = lod.t0;
+            for (const TaskState& s : level.runs) {
+                p.svarint(s.ts - prev);
+                prev = s.ts;
+            }
+            for (const TaskState& s : level.runs) {
+                p.u8(s.state);
+            }
+        }
+    }
+    p.varint(0);
+}
+
+// Blocks are written as soon as they are encoded; only the index
+// (a few entries per block) is held until the footer.
+int write_native(Trace& trace, int fd, int64_t block_ns) {
+    Writer w(fd);
+    size_t ntracks = trace.tracks.size();
+
+    int64_t tmin = 0x7FFFFFFFFFFFFFFFL;
+    for (Track* t : trace.tracks) {
+        if (t->task.size() && (t->task[0].ts < tmin)) {
+            tmin = t->task[0].ts;
+        }
+        if (t->event.size() && (t->event[0].ts < tmin)) {
+            tmin = t->event[0].ts;
+        }
+    }
+    if (tmin == 0x7FFFFFFFFFFFFFFFL) {
+        tmin = 0;
+    }
+
+    Packer p;
+    p.u32(TVZ_MAGIC);
+    p.u32(TVZ_VERSION);
+    p.u64(tmin);
+    p.u64(block_ns);
+    p.u64(0);
+    w.write(p.buf.data(), p.buf.size());
+
+    std::vector<size_t> taskpos(ntracks);
+    std::vector<size_t> eventpos(ntracks);
+    std::vector<NativeBlock> blocks;
+#ifdef WITH_ZSTD
+    std::vector<uint8_t> zbuf;
+#endif
+
+    for (;;) {
+        // start at the block holding the earliest data not yet written
+        int64_t next = 0x7FFFFFFFFFFFFFFFL;
+        for (Track* t : trace.tracks) {
+            if (taskpos[t->idx] < t->task.size()) {
+                next = std::min(next, t->task[taskpos[t->idx]].ts);
+            }
+            if (eventpos[t->idx] < t->event.size()) {
+                next = std::min(next, t->event[eventpos[t->idx]].ts);
+            }
+        }
+        if (next == 0x7FFFFFFFFFFFFFFFL) {
+            break;
+        }
+
+        NativeBlock blk;
+        blk.t0 = tmin + ((next - tmin) / block_ns) * block_ns;
+        blk.t1 = blk.t0 + block_ns;
+        blk.flags = 0;
+        p.clear();
+        for (Track* t : trace.tracks) {
+            size_t ti = taskpos[t->idx];
+            size_t ei = eventpos[t->idx];
+            size_t tn = std::lower_bound(t->task.begin() + ti, t->task.end(), blk.t1) - t->task.begin();
+            size_t en = std::lower_bound(t->event.begin() + ei, t->event.end(), blk.t1) - t->event.begin();
+            if ((tn == ti) && (en == ei)) {
+                continue;
+            }
+            NativeSegment seg;
+            seg.trackidx = t->idx;
+            seg.offset = p.buf.size();
+            seg.ntask = tn - ti;
+            seg.nevent = en - ei;
+            seg.task_first = ti;
+            seg.event_first = ei;
+            encode_segment(p, blk.t0, t, ti, tn, ei, en);
+            seg.size = p.buf.size() - seg.offset;
+            blk.segs.push_back(seg);
+            taskpos[t->idx] = tn;
+            eventpos[t->idx] = en;
+        }
+
+        blk.offset = w.offset();
+        blk.raw_size = p.buf.size();
+        const uint8_t* data = p.buf.data();
+        blk.size = p.buf.size();
+#ifdef WITH_ZSTD
+        zbuf.resize(ZSTD_compressBound(p.buf.size()));
+        size_t zn = ZSTD_compress(zbuf.data(), zbuf.size(), p.buf.data(), p.buf.size(), 3);
+        if (!ZSTD_isError(zn) && (zn < p.buf.size())) {
+            data = zbuf.data();
+            blk.size = zn;
+            blk.flags |= TVZ_BLOCK_ZSTD;
+        }
+#endif
+        w.write(data, blk.size);
+        blocks.push_back(blk);
+        column_tick();
+    }
+
+    // footer
+    uint64_t footer = w.offset();
+    p.clear();
+    p.varint(trace.first_timestamp);
+    write_names(p, trace.syscall_names);
+    write_names(p, trace.probe_names);
+    p.varint(ntracks);
+    for (Track* t : trace.tracks) {
+        p.varint(t->id);
+        p.str(t->name);
+    }
+    uint32_t ngroups = 0;
+    for (Group* g = trace.get_groups(); g != nullptr; g = g->next) {
+        ngroups++;
+    }
+    p.varint(ngroups);
+    for (Group* g = trace.get_groups(); g != nullptr; g = g->next) {
+        p.varint(g->id);
+        p.varint(g->flags);
+        p.str(g->name);
+        uint32_t n = 0;
+        for (Track* t = g->first; t != nullptr; t = t->next) {
+            n++;
+        }
+        p.varint(n);
+        for (Track* t = g->first; t != nullptr; t = t->next) {
+            p.varint(t->idx);
+        }
+    }
+    p.varint(blocks.size());
+    for (auto& blk : blocks) {
+        p.svarint(blk.t0);
+        p.svarint(blk.t1);
+        p.varint(blk.offset);
+        p.varint(blk.size);
+        p.varint(blk.raw_size);
+        p.varint(blk.flags);
+        p.varint(blk.segs.size());
+        for (auto& seg : blk.segs) {
+            p.varint(seg.trackidx);
+            p.varint(seg.offset);
+            p.varint(seg.size);
+            p.varint(seg.ntask);
+            p.varint(seg.nevent);
+            p.varint(seg.task_first);
+            p.varint(seg.event_first);
+        }
+    }
+    write_summaries(p, trace);
+    uint32_t footer_size = p.buf.size();
+    p.u64(footer);
+    p.u32(footer_size);
+    p.u32(TVZ_TRAILER_MAGIC);
+    w.write(p.buf.data(), p.buf.size());
+    return w.flush();
+}
+
+// ---- reading ----
+
+static bool pread_all(int fd, void* data, size_t len, uint64_t off) {
+    uint8_t* ptr = (uint8_t*) data;
+    while (len > 0) {
+        ssize_t r = pread(fd, ptr, len, off);
+        if (r <= 0) {
+            return false;
+        }
+        ptr += r;
+        len -= r;
+        off += r;
+    }
+    return true;
+}
+
+static void read_names(Unpacker& u, Trace& trace, std::map<uint32_t,const char*>& names) {
+    uint64_t count = u.varint();
+    for (uint64_t n = 0; (n < count) && !u.error; n++) {
+        uint32_t num = u.varint();
+        names[num] = u.str(trace);
+    }
+}
+
+// version 1 files have no summaries, so those parts of the view stay
+// empty; the time range comes from the blocks
+static void read_summaries(Unpacker& u, Trace& trace, const NativeFile& file) {
+    Overview& ov = trace.overview;
+    ov.t0 = ov.t1 = 0;
+    ov.busy.assign(OVERVIEW_BUCKETS, 0);
+    ov.events.assign(OVERVIEW_BUCKETS, 0);
+    ov.busy_max = 0;
+    ov.events_max = 0;
+    trace.counters.clear();
+    trace.task_lod.t0 = 0;
+    trace.task_lod.levels.assign(trace.tracks.size(), std::vector<TaskLodLevel>());
+
+    if (file.version < 2) {
+        trace.residency.tmin = file.blocks.empty() ? 0 : file.blocks.front().t0;
+        trace.residency.tmax = file.blocks.empty() ? -1 : file.blocks.back().t1;
+        return;
+    }
+    trace.residency.tmin = u.svarint();
+    trace.residency.tmax = u.svarint();
+
+    ov.t0 = u.svarint();
+    ov.t1 = u.svarint();
+    if (u.varint() != OVERVIEW_BUCKETS) {
+        u.error = true;
+        return;
+    }
+    for (size_t n = 0; (n < OVERVIEW_BUCKETS) && !u.error; n++) {
+        ov.busy[n] = u.f32();
+        ov.events[n] = u.varint();
+        ov.busy_max = std::max(ov.busy_max, ov.busy[n]);
+        ov.events_max = std::max(ov.events_max, ov.events[n]);
+    }
+
+    uint64_t ncounters = u.varint();
+    for (uint64_t i = 0; (i < ncounters) && !u.error; i++) {
+        trace.counters.push_back(Counter());
+        Counter& c = trace.counters.back();
+        c.name = u.str(trace);
+        c.t0 = u.svarint();
+        c.width = u.varint();
+        uint64_t buckets = u.varint();
+        if ((c.width == 0) || (buckets == 0) || (buckets > (uint64_t) (u.end - u.ptr))) {
+            u.error = true;
+            return;
+        }
+        c.min.resize(1);
+        c.max.resize(1);
+        c.min[0].resize(buckets);
+        c.max[0].resize(buckets);
+        for (uint64_t n = 0; n < buckets; n++) {
+            c.min[0][n] = u.f32();
+            c.max[0][n] = u.f32();
+        }
+        c.build_levels();
+    }
+
+    TaskLod& lod = trace.task_lod;
+    lod.t0 = u.svarint();
+    for (uint64_t idx; ((idx = u.varint()) != 0) && !u.error; ) {
+        if (idx > trace.tracks.size()) {
+            u.error = true;
+            return;
+        }
+        std::vector<TaskLodLevel>& levels = lod.levels[idx - 1];
+        uint64_t nlevels = u.varint();
+        for (uint64_t n = 0; (n < nlevels) && !u.error; n++) {
+            levels.push_back(TaskLodLevel());
+            TaskLodLevel& level = levels.back();
+            level.width = u.varint();
+            uint64_t count = u.varint();
+            if (count > (uint64_t) (u.end - u.ptr)) {
+                u.error = true;
+                return;
+            }
+            level.runs.resize(count);
+            int64_t prev = lod.t0;
+            for (TaskState& s : level.runs) {
+                prev += u.svarint();
+                s.ts = prev;
+                s.cpu = 0;
+            }
+            for (TaskState& s : level.runs) {
+                s.state = u.u8();
+            }
+        }
+    }
+}
+
+int NativeFile::open(int _fd, Trace& trace) {
+    fd = _fd;
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || (st.st_size < (TVZ_HDRSIZE + TVZ_TRAILERSIZE))) {
+        return -1;
+    }
+
+    uint8_t hdr[TVZ_HDRSIZE];
+    uint8_t trailer[TVZ_TRAILERSIZE];
+    if (!pread_all(fd, hdr, sizeof(hdr), 0) ||
+        !pread_all(fd, trailer, sizeof(trailer), st.st_size - TVZ_TRAILERSIZE)) {
+        return -1;
+    }
+    Unpacker uh(hdr, sizeof(hdr));
+    if ((uh.u32() != TVZ_MAGIC) || ((version = uh.u32()) < 1) || (version > TVZ_VERSION)) {
+        fprintf(stderr, "error: unsupported tvz file\n");
+        return -1;
+    }
+    tmin = uh.u64();
+    block_ns = uh.u64();
+    Unpacker ut(trailer, sizeof(trailer));
+    uint64_t footer = ut.u64();
+    uint32_t footer_size = ut.u32();
+    if ((ut.u32() != TVZ_TRAILER_MAGIC) ||
+        ((footer + footer_size + TVZ_TRAILERSIZE) != (uint64_t) st.st_size)) {
+        fprintf(stderr, "error: corrupt tvz trailer\n");
+        return -1;
+    }
+
+    std::vector<uint8_t> data(footer_size);
+    if (!pread_all(fd, data.data(), footer_size, footer)) {
+        return -1;
+    }
+    Unpacker u(data.data(), data.size());
+    trace.first_timestamp = u.varint();
+    read_names(u, trace, trace.syscall_names);
+    read_names(u, trace, trace.probe_names);
+
+    uint64_t ntracks = u.varint();
+    for (uint64_t n = 0; (n < ntracks) && !u.error; n++) {
+        Track* t = trace.track_create();
+        t->id = u.varint();
+        t->name = u.str(trace);
+    }
+    uint64_t ngroups = u.varint();
+    for (uint64_t n = 0; (n < ngroups) && !u.error; n++) {
+        Group* g = trace.group_create();
+        g->id = u.varint();
+        g->flags = u.varint();
+        g->name = u.str(trace);
+        uint64_t count = u.varint();
+        for (uint64_t i = 0; (i < count) && !u.error; i++) {
+            uint64_t idx = u.varint();
+            if (idx >= trace.tracks.size()) {
+                u.error = true;
+                break;
+            }
+            trace.group_add_track(g, trace.tracks[idx]);
+        }
+    }
+
+    uint64_t nblocks = u.varint();
+    for (uint64_t n = 0; (n < nblocks) && !u.error; n++) {
+        NativeBlock blk;
+        blk.t0 = u.svarint();
+        blk.t1 = u.svarint();
+        blk.offset = u.varint();
+        blk.size = u.varint();
+        blk.raw_size = u.varint();
+        blk.flags = u.varint();
+        uint64_t nsegs = u.varint();
+        for (uint64_t i = 0; (i < nsegs) && !u.error; i++) {
+            NativeSegment seg;
+            seg.trackidx = u.varint();
+            seg.offset = u.varint();
+            seg.size = u.varint();
+            seg.ntask = u.varint();
+            seg.nevent = u.varint();
+            seg.task_first = u.varint();
+            seg.event_first = u.varint();
+            if ((seg.trackidx >= ntracks) || ((seg.offset + (uint64_t) seg.size) > blk.raw_size)) {
+                u.error = true;
+                break;
+            }
+            blk.segs.push_back(seg);
+        }
+        blocks.push_back(blk);
+    }
+    if (!u.error) {
+        read_summaries(u, trace, *this);
+    }
+    if (u.error) {
+        fprintf(stderr, "error: corrupt tvz footer\n");
+        return -1;
+    }
+    return 0;
+}
+
+bool NativeFile::read_block(uint32_t n, std::vector<uint8_t>& raw) {
+    const NativeBlock& blk = blocks[n];
+    raw.resize(blk.raw_size);
+    if (!(blk.flags & TVZ_BLOCK_ZSTD)) {
+        return pread_all(fd, raw.data(), blk.size, blk.offset);
+    }
+#ifdef WITH_ZSTD
+    std::vector<uint8_t> data(blk.size);
+    if (!pread_all(fd, data.data(), blk.size, blk.offset)) {
+        return false;
+    }
+    size_t r = ZSTD_decompress(raw.data(), raw.size(), data.data(), data.size());
+    return !ZSTD_isError(r) && (r == raw.size());
+#else
+    fprintf(stderr, "error: zstd compressed tvz block, but built without zstd\n");
+    return false;
+#endif
+}
+
+bool NativeFile::decode_segment(const std::vector<uint8_t>& raw, const NativeSegment& seg,
+                                int64_t t0, TaskState* task, Event* event) {
+    Unpacker u(raw.data() + seg.offset, seg.size);
+
+    // each timestamp column is delta coded starting from the block start
+    int64_t prev = t0;
+    if (task) {
+        for (uint32_t n = 0; n < seg.ntask; n++) {
+            prev += u.svarint();
+            task[n].ts = prev;
+        }
+        for (uint32_t n = 0; n < seg.ntask; n++) task[n].state = u.u8();
+        for (uint32_t n = 0; n < seg.ntask; n++) task[n].cpu = u.u8();
+    } else {
+        for (uint32_t n = 0; n < seg.ntask; n++) {
+            u.varint();
+        }
+        u.ptr += 2 * seg.ntask;
+    }
+    if (event == nullptr) {
+        return !u.error && (u.ptr <= u.end);
+    }
+
+    prev = t0;
+    for (uint32_t n = 0; n < seg.nevent; n++) {
+        prev += u.svarint();
+        event[n].ts = prev;
+    }
+    for (uint32_t n = 0; n < seg.nevent; n++) event[n].tag = u.varint();
+    for (uint32_t n = 0; n < seg.nevent; n++) event[n].trackidx = u.varint();
+    for (uint32_t n = 0; n < seg.nevent; n++) event[n].eventidx = u.varint();
+    for (uint32_t n = 0; n < seg.nevent; n++) event[n].a = u.varint();
+    for (uint32_t n = 0; n < seg.nevent; n++) event[n].b = u.varint();
+    for (uint32_t n = 0; n < seg.nevent; n++) event[n].c = u.varint();
+    for (uint32_t n = 0; n < seg.nevent; n++) event[n].d = u.varint();
+    return !u.error;
+}
+
+// Loads track chunks out of a native file. Each chunk is one track's
+// segment of one block (the chunk key is the block number). Reading
+// and decompressing whole blocks is the slow part, so a worker thread
+// does that ahead of time for prefetched blocks, and recently used
+// blocks are kept around for the neighbouring tracks that need them.
+struct NativePager : ColumnPager {
+    NativeFile file;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<uint32_t> requests;
+    std::deque<uint32_t> recent; // cached block numbers, oldest first
+    std::unordered_map<uint32_t,std::shared_ptr<std::vector<uint8_t>>> cache;
+    std::thread worker;
+    bool done;
+
+    NativePager() : done(false) {}
+    ~NativePager();
+
+    void start(void);
+    void work(void);
+    void insert(uint32_t n, std::shared_ptr<std::vector<uint8_t>> raw);
+    std::shared_ptr<std::vector<uint8_t>> get_block(uint32_t n);
+
+    bool load(ColumnBase& col, ColumnChunk& c);
+    void prefetch(int64_t t0, int64_t t1);
+};
+
+// blocks kept decompressed for reuse
+#define NATIVE_CACHE_BLOCKS 8
+
+NativePager::~NativePager() {
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        done = true;
+    }
+    wake.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+    if (file.fd >= 0) {
+        close(file.fd);
+    }
+}
+
+void NativePager::start(void) {
+    worker = std::thread(&NativePager::work, this);
+}
+
+void NativePager::insert(uint32_t n, std::shared_ptr<std::vector<uint8_t>> raw) {
+    std::unique_lock<std::mutex> lk(lock);
+    if (cache.count(n)) {
+        return;
+    }
+    cache[n] = raw;
+    recent.push_back(n);
+    if (recent.size() > NATIVE_CACHE_BLOCKS) {
+        cache.erase(recent.front());
+        recent.pop_front();
+    }
+}
+
+void NativePager::work(void) {
+    for (;;) {
+        uint32_t n;
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            wake.wait(lk, [this] { return done || !requests.empty(); });
+            if (done) {
+                return;
+            }
+            n = requests.front();
+            requests.pop_front();
+            if (cache.count(n)) {
+                continue;
+            }
+        }
+        std::shared_ptr<std::vector<uint8_t>> raw(new std::vector<uint8_t>());
+        if (file.read_block(n, *raw)) {
+            insert(n, raw);
+        }
+    }
+}
+
+std::shared_ptr<std::vector<uint8_t>> NativePager::get_block(uint32_t n) {
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        auto it = cache.find(n);
+        if (it != cache.end()) {
+            return it->second;
+        }
+    }
+    std::shared_ptr<std::vector<uint8_t>> raw(new std::vector<uint8_t>());
+    if (!file.read_block(n, *raw)) {
+        return nullptr;
+    }
+    insert(n, raw);
+    return raw;
+}
+
+// column ids are trackidx * 2, plus 1 for the event column
+bool NativePager::load(ColumnBase& col, ColumnChunk& c) {
+    uint32_t trackidx = col.id / 2;
+    bool events = col.id & 1;
+    std::shared_ptr<std::vector<uint8_t>> raw = get_block(c.key);
+    if (raw == nullptr) {
+        return false;
+    }
+    const NativeBlock& blk = file.blocks[c.key];
+    for (auto& seg : blk.segs) {
+        if (seg.trackidx != trackidx) {
+            continue;
+        }
+        c.data = (uint8_t*) malloc(((size_t) c.count) * col.elsize);
+        if (NativeFile::decode_segment(*raw, seg, blk.t0,
+                                       events ? nullptr : (TaskState*) c.data,
+                                       events ? (Event*) c.data : nullptr)) {
+            return true;
+        }
+        free(c.data);
+        c.data = nullptr;
+        return false;
+    }
+    return false;
+}
+
+void NativePager::prefetch(int64_t t0, int64_t t1) {
+    auto it = std::lower_bound(file.blocks.begin(), file.blocks.end(), t0,
+                               [](const NativeBlock& b, int64_t ts) { return b.t1 <= ts; });
+    std::unique_lock<std::mutex> lk(lock);
+    requests.clear();
+    for (; (it != file.blocks.end()) && (it->t0 < t1); ++it) {
+        uint32_t n = it - file.blocks.begin();
+        if (!cache.count(n) && (requests.size() < NATIVE_CACHE_BLOCKS / 2)) {
+            requests.push_back(n);
+        }
+    }
+    if (!requests.empty()) {
+        wake.notify_one();
+    }
+}
+
+// open a native file with every track paged from it on demand
+int Trace::import_native(int fd) {
+    // the pager reads from the file for as long as the trace is open
+    NativePager* np = new NativePager();
+    if ((fd = dup(fd)) < 0) {
+        delete np;
+        return -1;
+    }
+    if (np->file.open(fd, *this)) {
+        delete np;
+        return -1;
+    }
+    if (options.page_budget) {
+        np->budget = options.page_budget;
+    }
+
+    for (uint32_t n = 0; n < np->file.blocks.size(); n++) {
+        for (auto& seg : np->file.blocks[n].segs) {
+            Track* t = tracks[seg.trackidx];
+            if ((seg.task_first != t->task.size()) || (seg.event_first != t->event.size())) {
+                fprintf(stderr, "error: corrupt tvz index\n");
+                delete np;
+                return -1;
+            }
+            if (seg.ntask) {
+                t->task.append_chunk(seg.ntask, n);
+            }
+            if (seg.nevent) {
+                t->event.append_chunk(seg.nevent, n);
+            }
+        }
+    }
+    for (Track* t : tracks) {
+        t->task.pager = np;
+        t->task.id = t->idx * 2;
+        t->event.pager = np;
+        t->event.id = t->idx * 2 + 1;
+    }
+    pager = np;
+    np->start();
+
+    build_indexes();
+    return 0;
+}
+
+};
@@ -0,0 +1,94 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "traceviz.h"
+
+namespace tv {
+
+// TraceViz native trace file (.tvz)
+//
+// header:  magic "TVZ1", version, tmin, block_ns
+// blocks:  one per block_ns of trace time that has any data, each
+//          holding per-track columnar segments (varint encoded,
+//          optionally zstd compressed as a whole)
+// footer:  names, groups, tracks, the block index, and (from version
+//          2) the summaries drawn zoomed out: time range, overview,
+//          counters, and the coarser task state levels
+// trailer: footer offset, footer size, magic "TVZF"
+//
+// The index alone tells which blocks hold which tracks at which
+// indices, so a reader can load just the blocks it needs. With the
+// summaries it can show the whole trace without reading any.
+
+#define TVZ_MAGIC         0x315A5654 // "TVZ1"
+#define TVZ_TRAILER_MAGIC 0x465A5654 // "TVZF"
+#define TVZ_VERSION       2
+
+// task state levels with more entries than this are not saved, so the
+// summaries grow with the number of tracks rather than their length
+#define TVZ_LOD_MAX_RUNS  (1 << 16)
+
+// counters are saved from their finest level with at most this many
+// buckets; a paged file shows them no finer than that
+#define TVZ_COUNTER_MAX_BUCKETS (1 << 14)
+
+#define TVZ_HDRSIZE       32
+#define TVZ_TRAILERSIZE   16
+
+// default trace time covered by one block, ~16.8ms
+#define TVZ_BLOCK_NS      (1LL << 24)
+
+#define TVZ_BLOCK_ZSTD    1
+
+// a track's slice of one block
+struct NativeSegment {
+    uint32_t trackidx;
+    uint32_t offset; // within the uncompressed block
+    uint32_t size;
+    uint32_t ntask;
+    uint32_t nevent;
+    uint64_t task_first;  // index in Track::task of the first task state
+    uint64_t event_first; // index in Track::event of the first event
+};
+
+struct NativeBlock {
+    int64_t t0;
+    int64_t t1;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t raw_size;
+    uint32_t flags;
+    std::vector<NativeSegment> segs;
+};
+
+struct NativeFile {
+    int fd;
+    uint32_t version;
+    int64_t tmin;
+    int64_t block_ns;
+    std::vector<NativeBlock> blocks;
+
+    NativeFile() : fd(-1), version(0), tmin(0), block_ns(TVZ_BLOCK_NS) {}
+
+    // read the footer, recreating groups, tracks, names and summaries
+    // in trace (with empty task/event arrays), returns 0 on success
+    int open(int fd, Trace& trace);
+
+    // read and decompress a whole block
+    bool read_block(uint32_t n, std::vector<uint8_t>& raw);
+
+    // decode one segment of a block (starting at t0) read by read_block()
+    static bool decode_segment(const std::vector<uint8_t>& raw, const NativeSegment& seg,
+                               int64_t t0, TaskState* task, Event* event);
+};
+
+int write_native(Trace& trace, int fd, int64_t block_ns = TVZ_BLOCK_NS);
+
+};
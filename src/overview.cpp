@@ -0,0 +1,76 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+
+#include "traceviz.h"
+
+namespace tv {
+
+// Buckets are a fraction of the trace wide, so time within them is kept
+// as a fraction of a bucket. Running time is split between the buckets
+// it spans, which sums to mean cpus busy.
+void Overview::build(Trace& trace) {
+    t0 = 0x7FFFFFFFFFFFFFFFL;
+    t1 = -0x7FFFFFFFFFFFFFFFL;
+    for (Track* t : trace.tracks) {
+        if (t->task.size()) {
+            t0 = std::min(t0, t->task[0].ts);
+            t1 = std::max(t1, t->task.back().ts);
+        }
+        if (t->event.size()) {
+            t0 = std::min(t0, t->event[0].ts);
+            t1 = std::max(t1, t->event.back().ts);
+        }
+    }
+    busy.assign(OVERVIEW_BUCKETS, 0);
+    events.assign(OVERVIEW_BUCKETS, 0);
+    busy_max = 0;
+    events_max = 0;
+    if (t0 >= t1) {
+        t0 = t1 = 0;
+        return;
+    }
+    double width = (double) (t1 - t0) / OVERVIEW_BUCKETS;
+    size_t last = OVERVIEW_BUCKETS - 1;
+
+    size_t walked = 0;
+    for (Track* t : trace.tracks) {
+        // busy is the mean of cpus running anything but their idle thread
+        bool idle = is_idle_track(t);
+        for (size_t n = 0; !idle && ((n + 1) < t->task.size()); n++) {
+            if (t->task[n].state != TS_RUNNING) {
+                continue;
+            }
+            double f0 = (t->task[n].ts - t0) / width;
+            double f1 = (t->task[n + 1].ts - t0) / width;
+            size_t b0 = std::min(last, (size_t) f0);
+            size_t b1 = std::min(last, (size_t) f1);
+            if (b0 == b1) {
+                busy[b0] += f1 - f0;
+                continue;
+            }
+            busy[b0] += (b0 + 1) - f0;
+            for (size_t b = b0 + 1; b < b1; b++) {
+                busy[b] += 1.0f;
+            }
+            busy[b1] += f1 - b1;
+            if ((++walked & 0xFFFF) == 0) {
+                column_tick();
+            }
+        }
+        for (const Event& e : t->event) {
+            events[std::min(last, (size_t) ((e.ts - t0) / width))]++;
+            if ((++walked & 0xFFFF) == 0) {
+                column_tick();
+            }
+        }
+    }
+    for (size_t b = 0; b < OVERVIEW_BUCKETS; b++) {
+        busy_max = std::max(busy_max, busy[b]);
+        events_max = std::max(events_max, events[b]);
+    }
+}
+
+};
@@ -0,0 +1,187 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include "traceviz.h"
+
+namespace tv {
+
+static const ProbePairRule default_rules[] = {
+    { "*_begin", "*_end", 0, 0 },
+    { "begin_*", "end_*", 0, 0 },
+};
+#define DEFAULT_RULES (sizeof(default_rules) / sizeof(default_rules[0]))
+
+// match name against a pattern with at most one '*' (a pattern without
+// one is a prefix), returning what the '*' stood for
+static bool match_pattern(const std::string& name, const char* pattern, std::string& base) {
+    const char* star = strchr(pattern, '*');
+    size_t pre = star ? (size_t) (star - pattern) : strlen(pattern);
+    size_t post = star ? strlen(star + 1) : 0;
+    if ((name.size() <= (pre + post)) || name.compare(0, pre, pattern, pre) ||
+        name.compare(name.size() - post, post, star ? (star + 1) : "", post)) {
+        return false;
+    }
+    base = name.substr(pre, name.size() - pre - post);
+    return true;
+}
+
+// the name a pattern gives to base
+static std::string fill_pattern(const char* pattern, const std::string& base) {
+    const char* star = strchr(pattern, '*');
+    if (star == nullptr) {
+        return pattern + base;
+    }
+    return std::string(pattern, star - pattern) + base + (star + 1);
+}
+
+static void add_pair(Trace& trace, std::vector<ProbePair>& pairs,
+                     std::map<uint32_t,bool>& used, const char* name,
+                     uint32_t begin_tag, uint32_t end_tag) {
+    if (used[begin_tag] || used[end_tag] || (begin_tag == end_tag)) {
+        return;
+    }
+    used[begin_tag] = true;
+    used[end_tag] = true;
+
+    ProbePair p;
+    memset(&p, 0, sizeof(p));
+    p.name = trace.intern(name);
+    p.begin_tag = begin_tag;
+    p.end_tag = end_tag;
+    p.min = 0x7FFFFFFFFFFFFFFFL;
+    pairs.push_back(p);
+}
+
+// turn the rules into begin/end tag pairs for the probes this trace has
+static void resolve_rules(Trace& trace, std::vector<ProbePair>& pairs) {
+    const ImportOptions& opt = trace.options;
+    std::map<std::string,uint32_t> byname;
+    for (auto& it : trace.probe_names) {
+        if (it.second != nullptr) {
+            byname[it.second] = it.first;
+        }
+    }
+    std::map<uint32_t,bool> used;
+    unsigned count = opt.probe_rule_count ? opt.probe_rule_count : DEFAULT_RULES;
+    for (unsigned n = 0; n < count; n++) {
+        const ProbePairRule& r = opt.probe_rule_count ? opt.probe_rules[n] : default_rules[n];
+        if (r.begin == nullptr) {
+            uint32_t begin_tag = r.begin_num + EVT_PROBE;
+            char tmp[32];
+            const char* name = trace.probe_name(begin_tag);
+            if (name == nullptr) {
+                snprintf(tmp, sizeof(tmp), "probe %03x", r.begin_num);
+                name = tmp;
+            }
+            add_pair(trace, pairs, used, name, begin_tag, r.end_num + EVT_PROBE);
+            continue;
+        }
+        std::string base;
+        for (auto& it : byname) {
+            if (!match_pattern(it.first, r.begin, base)) {
+                continue;
+            }
+            auto end = byname.find(fill_pattern(r.end, base));
+            if (end != byname.end()) {
+                add_pair(trace, pairs, used, base.c_str(), it.second, end->second);
+            }
+        }
+    }
+}
+
+static unsigned hist_bucket(int64_t ns) {
+    unsigned n = 0;
+    while ((ns > 1) && (n < (PROBE_HIST_BUCKETS - 1))) {
+        ns >>= 1;
+        n++;
+    }
+    return n;
+}
+
+// For each pair, the begin and end probes of a track are merged in
+// event order from the tag index, so only probe events are visited. An
+// end closes the latest open begin, which lets spans nest.
+void ProbeIndex::build(Trace& trace) {
+    pairs.clear();
+    spans.assign(trace.tracks.size(), std::vector<ProbeSpan>());
+    longest.assign(trace.tracks.size(), 0);
+    resolve_rules(trace, pairs);
+
+    std::vector<int64_t> open;
+    for (size_t n = 0; n < pairs.size(); n++) {
+        ProbePair& p = pairs[n];
+        const TagIndex* bi = trace.tag_events(p.begin_tag);
+        const TagIndex* ei = trace.tag_events(p.end_tag);
+        static const std::vector<EventRef> none;
+        const std::vector<EventRef>& b = bi ? bi->by_track : none;
+        const std::vector<EventRef>& e = ei ? ei->by_track : none;
+        size_t i = 0, j = 0;
+        open.clear();
+        int32_t track = -1;
+        while ((i < b.size()) || (j < e.size())) {
+            bool is_begin = (j == e.size()) || ((i < b.size()) && (b[i] < e[j]));
+            const EventRef& ref = is_begin ? b[i++] : e[j++];
+            if (ref.trackidx != track) {
+                p.unmatched += open.size();
+                open.clear();
+                track = ref.trackidx;
+                column_tick();
+            }
+            int64_t ts = trace.get_event(ref)->ts;
+            if (is_begin) {
+                open.push_back(ts);
+                continue;
+            }
+            if (open.empty()) {
+                p.unmatched++;
+                continue;
+            }
+            ProbeSpan s;
+            s.t0 = open.back();
+            s.t1 = ts;
+            s.pair = n;
+            s.depth = 0;
+            open.pop_back();
+            spans[ref.trackidx].push_back(s);
+
+            int64_t len = s.t1 - s.t0;
+            p.count++;
+            p.total += len;
+            p.min = std::min(p.min, len);
+            p.max = std::max(p.max, len);
+            p.hist[hist_bucket(len)]++;
+            longest[ref.trackidx] = std::max(longest[ref.trackidx], len);
+        }
+        p.unmatched += open.size();
+        if (p.count == 0) {
+            p.min = 0;
+        }
+    }
+
+    // spans of all pairs on a track, outermost first where they start
+    // together, each one deeper than the spans still open around it
+    std::vector<int64_t> ends;
+    for (auto& list : spans) {
+        std::sort(list.begin(), list.end(), [](const ProbeSpan& a, const ProbeSpan& b) {
+            return (a.t0 != b.t0) ? (a.t0 < b.t0) : (a.t1 > b.t1);
+        });
+        ends.clear();
+        for (auto& s : list) {
+            while (!ends.empty() && (ends.back() <= s.t0)) {
+                ends.pop_back();
+            }
+            s.depth = ends.size();
+            ends.push_back(s.t1);
+        }
+    }
+}
+
+};
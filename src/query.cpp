@@ -0,0 +1,427 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <algorithm>
+#include <queue>
+
+#include "traceviz.h"
+
+namespace tv {
+
+static void reserve(TagIndex& ti, size_t n) {
+    ti.ts.reserve(n);
+    ti.refs.reserve(n);
+    ti.by_track.reserve(n);
+}
+
+// k-way merge of every track's (already time ordered) events
+// into per-tag posting lists, so each list comes out sorted
+void Trace::build_tag_index(void) {
+    std::map<uint32_t,size_t> counts;
+    std::map<uint64_t,size_t> syscall_counts;
+    for (Track* t : tracks) {
+        for (auto& e : t->event) {
+            counts[e.tag]++;
+            if (is_syscall_tag(e.tag)) {
+                syscall_counts[syscall_key(e.tag, e.a)]++;
+            }
+        }
+        column_tick();
+    }
+    tag_index.clear();
+    for (auto& c : counts) {
+        reserve(tag_index[c.first], c.second);
+    }
+    syscall_index.clear();
+    for (auto& c : syscall_counts) {
+        reserve(syscall_index[c.first], c.second);
+    }
+
+    // tracks in index order yields by_track already sorted
+    for (Track* t : tracks) {
+        EventRef ref;
+        ref.trackidx = t->idx;
+        for (ref.eventidx = 0; ref.eventidx < t->event.size(); ref.eventidx++) {
+            const Event& e = t->event[ref.eventidx];
+            tag_index[e.tag].by_track.push_back(ref);
+            if (is_syscall_tag(e.tag)) {
+                syscall_index[syscall_key(e.tag, e.a)].by_track.push_back(ref);
+            }
+        }
+        column_tick();
+    }
+
+    std::priority_queue<TrackCursor> heap;
+    for (Track* t : tracks) {
+        if (t->event.size()) {
+            TrackCursor mc;
+            mc.ts = t->event[0].ts;
+            mc.trackidx = t->idx;
+            mc.idx = 0;
+            mc.end = t->event.size();
+            heap.push(mc);
+        }
+    }
+    size_t merged = 0;
+    while (!heap.empty()) {
+        // only indices are held across iterations
+        if ((++merged & 0xFFFF) == 0) {
+            column_tick();
+        }
+        TrackCursor mc = heap.top();
+        heap.pop();
+        Track* t = tracks[mc.trackidx];
+        const Event& e = t->event[mc.idx];
+        TagIndex& ti = tag_index[e.tag];
+        EventRef ref;
+        ref.trackidx = mc.trackidx;
+        ref.eventidx = mc.idx;
+        ti.ts.push_back(mc.ts);
+        ti.refs.push_back(ref);
+        if ((e.tag == EVT_CHANNEL_WRITE) || (e.tag == EVT_CHANNEL_READ)) {
+            if (ti.cum_a.empty()) {
+                ti.cum_a.push_back(0);
+            }
+            ti.cum_a.push_back(ti.cum_a.back() + e.a);
+        } else if (is_syscall_tag(e.tag)) {
+            TagIndex& si = syscall_index[syscall_key(e.tag, e.a)];
+            si.ts.push_back(mc.ts);
+            si.refs.push_back(ref);
+        }
+        if (++mc.idx < mc.end) {
+            mc.ts = t->event[mc.idx].ts;
+            heap.push(mc);
+        }
+    }
+}
+
+const TagIndex* Trace::tag_events(uint32_t tag) {
+    auto it = tag_index.find(tag);
+    if (it == tag_index.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+const TagIndex* Trace::syscall_events(uint32_t tag, uint32_t num) {
+    auto it = syscall_index.find(syscall_key(tag, num));
+    if (it == syscall_index.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+#define KTRACE_DEF(num,type,name,group) { num, #name },
+static const struct {
+    uint32_t tag;
+    const char* name;
+} tag_names[] = {
+#include "ktrace-def.h"
+};
+
+// resolve an event, syscall, or probe name into query constraints
+bool Trace::query_name(Query& q, const char* name) {
+    for (auto& tn : tag_names) {
+        if (!strcasecmp(tn.name, name)) {
+            q.tag = tn.tag;
+            return true;
+        }
+    }
+    for (auto& sn : syscall_names) {
+        if (sn.second && !strcmp(sn.second, name)) {
+            q.tag = EVT_SYSCALL_ENTER;
+            q.args |= QRY_ARG_A;
+            q.a = sn.first;
+            return true;
+        }
+    }
+    for (auto& pn : probe_names) {
+        if (pn.second && !strcmp(pn.second, name)) {
+            q.tag = pn.first;
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool query_match(const Query& q, uint32_t args, const Event& e) {
+    if ((args & QRY_ARG_A) && (e.a != q.a)) {
+        return false;
+    }
+    if ((args & QRY_ARG_B) && (e.b != q.b)) {
+        return false;
+    }
+    return true;
+}
+
+static inline bool query_track(const Query& q, uint16_t trackidx) {
+    return q.tracks.empty() || ((trackidx < q.tracks.size()) && q.tracks[trackidx]);
+}
+
+// Merge the cursors in time order, keeping events before q.t1 that
+// match until there are q.limit of them. ref_at() gives the event
+// under a cursor; only the fields in args need checking. A cursor
+// stays out of the heap for as long as it is still the earliest, so
+// one busy track costs no heap operations.
+template <typename F>
+static void query_merge(Trace& trace, const Query& q, uint32_t args,
+                        std::priority_queue<TrackCursor>& heap, F ref_at,
+                        std::vector<EventRef>& out) {
+    while (!heap.empty()) {
+        TrackCursor c = heap.top();
+        heap.pop();
+        while (c.ts < q.t1) {
+            EventRef ref = ref_at(c);
+            if (!args || query_match(q, args, *trace.get_event(ref))) {
+                out.push_back(ref);
+                if (out.size() == q.limit) {
+                    return;
+                }
+            }
+            if (++c.idx == c.end) {
+                break;
+            }
+            c.ts = trace.get_event(ref_at(c))->ts;
+            if (!heap.empty() && (heap.top().ts < c.ts)) {
+                heap.push(c);
+                break;
+            }
+        }
+    }
+}
+
+size_t Trace::query(const Query& q, std::vector<EventRef>& out) {
+    out.clear();
+    if ((q.t0 >= q.t1) || (q.limit == 0)) {
+        return 0;
+    }
+    std::priority_queue<TrackCursor> heap;
+
+    if (q.tag >= 0) {
+        // a syscall number has a posting list of its own, which leaves
+        // nothing to check against a
+        uint32_t args = q.args;
+        const TagIndex* ti;
+        if (is_syscall_tag(q.tag) && (args & QRY_ARG_A)) {
+            ti = syscall_events(q.tag, q.a);
+            args &= ~QRY_ARG_A;
+        } else {
+            ti = tag_events(q.tag);
+        }
+        if (ti == nullptr) {
+            return 0;
+        }
+
+        // every track: the list is in time order already
+        if (q.tracks.empty()) {
+            size_t n = std::lower_bound(ti->ts.begin(), ti->ts.end(), q.t0) - ti->ts.begin();
+            for (; (n < ti->ts.size()) && (ti->ts[n] < q.t1) && (out.size() < q.limit); n++) {
+                const EventRef& ref = ti->refs[n];
+                if (!args || query_match(q, args, *get_event(ref))) {
+                    out.push_back(ref);
+                }
+            }
+            return out.size();
+        }
+
+        // some tracks: seek each one's run of by_track to t0
+        const std::vector<EventRef>& list = ti->by_track;
+        auto track_less = [](const EventRef& a, const EventRef& b) {
+            return a.trackidx < b.trackidx;
+        };
+        auto ts_less = [this](const EventRef& ref, int64_t ts) {
+            return get_event(ref)->ts < ts;
+        };
+        for (Track* t : tracks) {
+            if (!query_track(q, t->idx)) {
+                continue;
+            }
+            EventRef key;
+            key.trackidx = t->idx;
+            key.eventidx = 0;
+            auto run = std::equal_range(list.begin(), list.end(), key, track_less);
+            auto first = std::lower_bound(run.first, run.second, q.t0, ts_less);
+            if (first != run.second) {
+                TrackCursor c;
+                c.ts = get_event(*first)->ts;
+                c.trackidx = t->idx;
+                c.idx = first - list.begin();
+                c.end = run.second - list.begin();
+                heap.push(c);
+            }
+        }
+        query_merge(*this, q, args, heap, [&list](const TrackCursor& c) {
+            return list[c.idx];
+        }, out);
+        return out.size();
+    }
+
+    // no tag: seek into each candidate track's events
+    for (Track* t : tracks) {
+        if (!query_track(q, t->idx)) {
+            continue;
+        }
+        size_t first = std::lower_bound(t->event.begin(), t->event.end(), q.t0) - t->event.begin();
+        if (first < t->event.size()) {
+            TrackCursor c;
+            c.ts = t->event[first].ts;
+            c.trackidx = t->idx;
+            c.idx = first;
+            c.end = t->event.size();
+            heap.push(c);
+        }
+    }
+    query_merge(*this, q, q.args, heap, [](const TrackCursor& c) {
+        EventRef ref;
+        ref.trackidx = c.trackidx;
+        ref.eventidx = c.idx;
+        return ref;
+    }, out);
+    return out.size();
+}
+
+static inline void count_range(const std::vector<int64_t>& ts, int64_t t0, int64_t t1,
+                               size_t* lo, size_t* hi) {
+    *lo = std::lower_bound(ts.begin(), ts.end(), t0) - ts.begin();
+    *hi = std::lower_bound(ts.begin() + *lo, ts.end(), t1) - ts.begin();
+}
+
+// everything here comes from posting lists and prefix sums, so the
+// cost depends on the number of tags, syscalls and tracks, not events
+void Trace::mark_stats(int64_t t0, int64_t t1, MarkStats& out) {
+    out.t0 = t0;
+    out.t1 = t1;
+    out.tags.clear();
+    out.syscalls.clear();
+    out.ipc_writes = out.ipc_reads = 0;
+    out.ipc_write_bytes = out.ipc_read_bytes = 0;
+    size_t lo, hi;
+    for (auto& it : tag_index) {
+        count_range(it.second.ts, t0, t1, &lo, &hi);
+        if (hi == lo) {
+            continue;
+        }
+        out.tags.push_back(std::make_pair(it.first, (uint32_t) (hi - lo)));
+        if (it.first == EVT_CHANNEL_WRITE) {
+            out.ipc_writes = hi - lo;
+            out.ipc_write_bytes = it.second.cum_a[hi] - it.second.cum_a[lo];
+        } else if (it.first == EVT_CHANNEL_READ) {
+            out.ipc_reads = hi - lo;
+            out.ipc_read_bytes = it.second.cum_a[hi] - it.second.cum_a[lo];
+        }
+    }
+    auto end = syscall_index.lower_bound(syscall_key(EVT_SYSCALL_ENTER + 1, 0));
+    for (auto it = syscall_index.lower_bound(syscall_key(EVT_SYSCALL_ENTER, 0)); it != end; ++it) {
+        count_range(it->second.ts, t0, t1, &lo, &hi);
+        if (hi > lo) {
+            out.syscalls.push_back(std::make_pair((uint32_t) it->first, (uint32_t) (hi - lo)));
+        }
+    }
+    auto most = [](const std::pair<uint32_t,uint32_t>& a, const std::pair<uint32_t,uint32_t>& b) {
+        return a.second > b.second;
+    };
+    std::sort(out.tags.begin(), out.tags.end(), most);
+    std::sort(out.syscalls.begin(), out.syscalls.end(), most);
+
+    residency.query(*this, t0, t1, out.residency);
+    out.running.clear();
+    for (Track* t : tracks) {
+        int64_t time = out.residency.threads[t->idx].time[TS_RUNNING];
+        if (time > 0) {
+            out.running.push_back(std::make_pair(t->idx, time));
+        }
+    }
+    std::sort(out.running.begin(), out.running.end(),
+              [](const std::pair<uint16_t,int64_t>& a, const std::pair<uint16_t,int64_t>& b) {
+                  return a.second > b.second;
+              });
+}
+
+// one step through the posting list of the event's kind: its tag, or
+// for a syscall its tag and number
+bool Trace::find_adjacent(const EventRef& from, int dir, bool any_track, EventRef& out) {
+    const Event* evt = get_event(from);
+    const TagIndex* ti = is_syscall_tag(evt->tag) ? syscall_events(evt->tag, evt->a) :
+                         tag_events(evt->tag);
+    if (ti == nullptr) {
+        return false;
+    }
+
+    if (any_track) {
+        // seek to the first event at this timestamp, then to 'from' itself
+        size_t n = std::lower_bound(ti->ts.begin(), ti->ts.end(), evt->ts) - ti->ts.begin();
+        while ((n < ti->refs.size()) && !(ti->refs[n] == from)) {
+            n++;
+        }
+        if ((n == ti->refs.size()) || ((dir < 0) && (n == 0)) ||
+            ((dir > 0) && ((n + 1) == ti->refs.size()))) {
+            return false;
+        }
+        out = ti->refs[(dir > 0) ? (n + 1) : (n - 1)];
+        return true;
+    }
+
+    auto it = std::lower_bound(ti->by_track.begin(), ti->by_track.end(), from);
+    if ((it == ti->by_track.end()) || !(*it == from)) {
+        return false;
+    }
+    if (dir > 0) {
+        ++it;
+    } else if (it == ti->by_track.begin()) {
+        return false;
+    } else {
+        --it;
+    }
+    if ((it == ti->by_track.end()) || (it->trackidx != from.trackidx)) {
+        return false;
+    }
+    out = *it;
+    return true;
+}
+
+// find the next (or previous) TS_READY interval on a track, starting
+// strictly after (or before) ts and lasting at least minlen
+bool Trace::find_ready_run(Track* t, int64_t ts, int dir, int64_t minlen,
+                           int64_t& start, int64_t& end) {
+    auto first = t->task.begin();
+    auto last = t->task.end();
+    if (first == last) {
+        return false;
+    }
+    auto task = std::lower_bound(first, last, ts);
+    if (dir > 0) {
+        if ((task != last) && (task->ts == ts)) {
+            ++task;
+        }
+    } else {
+        if (task == first) {
+            return false;
+        }
+        --task;
+    }
+    for (;;) {
+        auto next = task + 1;
+        if ((task == last) || (next == last)) {
+            if (dir > 0) {
+                return false;
+            }
+        } else if ((task->state == TS_READY) && ((next->ts - task->ts) >= minlen)) {
+            start = task->ts;
+            end = next->ts;
+            return true;
+        }
+        if (dir > 0) {
+            ++task;
+        } else {
+            if (task == first) {
+                return false;
+            }
+            --task;
+        }
+    }
+}
+
+};
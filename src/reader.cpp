@@ -0,0 +1,374 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef WITH_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "reader.h"
+
+namespace tv {
+
+#define READ_BUFSIZE (1024 * 1024)
+
+// decompressed blocks in flight between the two threads
+#define BLOCK_SIZE (4 * 1024 * 1024)
+#define QUEUE_DEPTH 4
+
+#define ZSTD_MAGIC 0xFD2FB528
+#define LZ4_MAGIC  0x184D2204
+
+size_t Reader::read(void* data, size_t len) {
+    uint8_t* ptr = (uint8_t*) data;
+    size_t total = 0;
+    while (len > 0) {
+        if (avail == 0) {
+            if (!fill()) {
+                break;
+            }
+            continue;
+        }
+        size_t n = (len < avail) ? len : avail;
+        memcpy(ptr, cur, n);
+        cur += n;
+        avail -= n;
+        ptr += n;
+        len -= n;
+        total += n;
+    }
+    return total;
+}
+
+static ssize_t read_fd(int fd, uint8_t* buf, size_t len) {
+    for (;;) {
+        ssize_t r = ::read(fd, buf, len);
+        if ((r < 0) && (errno == EINTR)) {
+            continue;
+        }
+        return r;
+    }
+}
+
+// uncompressed input, read straight from the fd in large chunks
+struct FdReader : public Reader {
+    int fd;
+    std::vector<uint8_t> buf;
+    size_t prefix;
+
+    FdReader(int _fd, const uint8_t* data, size_t len) :
+        fd(_fd), buf(READ_BUFSIZE), prefix(len) {
+        memcpy(buf.data(), data, len);
+    }
+
+    virtual bool fill() {
+        // bytes sniffed by reader_open() go first
+        if (prefix) {
+            cur = buf.data();
+            avail = prefix;
+            prefix = 0;
+            return true;
+        }
+        ssize_t r = read_fd(fd, buf.data(), buf.size());
+        if (r <= 0) {
+            return false;
+        }
+        cur = buf.data();
+        avail = r;
+        return true;
+    }
+};
+
+// uncompressed input mapped whole, handed out as a single block
+struct MapReader : public Reader {
+    uint8_t* data;
+    size_t size;
+    bool done;
+
+    MapReader(uint8_t* _data, size_t _size) : data(_data), size(_size), done(false) {}
+    ~MapReader() {
+        munmap(data, size);
+    }
+
+    virtual bool fill() {
+        if (done) {
+            return false;
+        }
+        cur = data;
+        avail = size;
+        done = true;
+        return true;
+    }
+};
+
+// streaming decompressor, driven by the decompression thread
+struct Decoder {
+    virtual ~Decoder() {}
+    // decompress from in into out, updating both lengths to the
+    // amounts consumed and produced, returns false on corrupt input
+    virtual bool decode(const uint8_t* in, size_t& inlen, uint8_t* out, size_t& outlen) = 0;
+    virtual const char* name() = 0;
+};
+
+#ifdef WITH_ZSTD
+struct ZstdDecoder : public Decoder {
+    ZSTD_DCtx* ctx;
+    ZstdDecoder() : ctx(ZSTD_createDCtx()) {}
+    ~ZstdDecoder() {
+        ZSTD_freeDCtx(ctx);
+    }
+    virtual bool decode(const uint8_t* in, size_t& inlen, uint8_t* out, size_t& outlen) {
+        ZSTD_inBuffer ib = { in, inlen, 0 };
+        ZSTD_outBuffer ob = { out, outlen, 0 };
+        size_t r = ZSTD_decompressStream(ctx, &ob, &ib);
+        inlen = ib.pos;
+        outlen = ob.pos;
+        return !ZSTD_isError(r);
+    }
+    virtual const char* name() {
+        return "zstd";
+    }
+};
+#endif
+
+#ifdef WITH_LZ4
+struct Lz4Decoder : public Decoder {
+    LZ4F_dctx* ctx;
+    Lz4Decoder() : ctx(nullptr) {
+        LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION);
+    }
+    ~Lz4Decoder() {
+        LZ4F_freeDecompressionContext(ctx);
+    }
+    virtual bool decode(const uint8_t* in, size_t& inlen, uint8_t* out, size_t& outlen) {
+        size_t r = LZ4F_decompress(ctx, out, &outlen, in, &inlen, nullptr);
+        return !LZ4F_isError(r);
+    }
+    virtual const char* name() {
+        return "lz4";
+    }
+};
+#endif
+
+// Compressed input: a thread reads and decompresses into fixed size
+// blocks, handing them to the importer through a bounded queue, so
+// decompression overlaps with decoding records and memory stays at
+// QUEUE_DEPTH blocks no matter how large the trace is.
+struct ThreadReader : public Reader {
+    int fd;
+    Decoder* decoder;
+    std::vector<uint8_t> prefix;
+
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>*> full;
+    std::deque<std::vector<uint8_t>*> empty;
+    std::vector<uint8_t>* block;
+    size_t block_len;
+    bool done;
+    bool quit;
+    std::thread worker;
+
+    ThreadReader(int _fd, Decoder* dec, const uint8_t* data, size_t len) :
+        fd(_fd), decoder(dec), prefix(data, data + len),
+        block(nullptr), block_len(0), done(false), quit(false) {
+        for (unsigned n = 0; n < QUEUE_DEPTH; n++) {
+            empty.push_back(new std::vector<uint8_t>(BLOCK_SIZE));
+        }
+        worker = std::thread(&ThreadReader::run, this);
+    }
+
+    ~ThreadReader() {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            quit = true;
+        }
+        cv.notify_all();
+        worker.join();
+        for (auto b : full) {
+            delete b;
+        }
+        for (auto b : empty) {
+            delete b;
+        }
+        delete block;
+        delete decoder;
+    }
+
+    // producer side: wait for a free block (or shutdown)
+    std::vector<uint8_t>* get_empty() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (empty.empty() && !quit) {
+            cv.wait(guard);
+        }
+        if (quit) {
+            return nullptr;
+        }
+        auto b = empty.front();
+        empty.pop_front();
+        return b;
+    }
+
+    void put_full(std::vector<uint8_t>* b, size_t len) {
+        b->resize(len);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            full.push_back(b);
+        }
+        cv.notify_all();
+    }
+
+    void finish() {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            done = true;
+        }
+        cv.notify_all();
+    }
+
+    void run() {
+        std::vector<uint8_t> in(READ_BUFSIZE);
+        size_t inpos = 0;
+        size_t inlen = prefix.size();
+        memcpy(in.data(), prefix.data(), inlen);
+
+        std::vector<uint8_t>* out = get_empty();
+        size_t outpos = 0;
+        while (out != nullptr) {
+            size_t consumed = inlen - inpos;
+            size_t produced = BLOCK_SIZE - outpos;
+            out->resize(BLOCK_SIZE);
+            if (!decoder->decode(in.data() + inpos, consumed, out->data() + outpos, produced)) {
+                fprintf(stderr, "error: corrupt %s stream\n", decoder->name());
+                break;
+            }
+            inpos += consumed;
+            outpos += produced;
+            if (outpos == BLOCK_SIZE) {
+                put_full(out, outpos);
+                out = get_empty();
+                outpos = 0;
+                continue;
+            }
+            if ((consumed == 0) && (produced == 0)) {
+                // decoder is starved, refill the input
+                if (inpos < inlen) {
+                    memmove(in.data(), in.data() + inpos, inlen - inpos);
+                }
+                inlen -= inpos;
+                inpos = 0;
+                ssize_t r = read_fd(fd, in.data() + inlen, in.size() - inlen);
+                if (r <= 0) {
+                    break;
+                }
+                inlen += r;
+            }
+        }
+        if (out != nullptr) {
+            if (outpos) {
+                put_full(out, outpos);
+            } else {
+                std::unique_lock<std::mutex> guard(lock);
+                empty.push_back(out);
+            }
+        }
+        finish();
+    }
+
+    virtual bool fill() {
+        std::unique_lock<std::mutex> guard(lock);
+        // recycle the block we just finished with
+        if (block != nullptr) {
+            empty.push_back(block);
+            block = nullptr;
+            cv.notify_all();
+        }
+        while (full.empty() && !done) {
+            cv.wait(guard);
+        }
+        if (full.empty()) {
+            return false;
+        }
+        block = full.front();
+        full.pop_front();
+        cur = block->data();
+        avail = block->size();
+        return true;
+    }
+};
+
+bool reader_compressed(uint32_t magic) {
+    return (magic == ZSTD_MAGIC) || (magic == LZ4_MAGIC);
+}
+
+Reader* reader_open(int fd) {
+    uint8_t magic[4];
+    size_t len = 0;
+    while (len < sizeof(magic)) {
+        ssize_t r = read_fd(fd, magic + len, sizeof(magic) - len);
+        if (r <= 0) {
+            break;
+        }
+        len += r;
+    }
+    uint32_t n = 0;
+    if (len == sizeof(magic)) {
+        n = magic[0] | (magic[1] << 8) | (magic[2] << 16) | ((uint32_t)magic[3] << 24);
+    }
+
+    if (n == ZSTD_MAGIC) {
+#ifdef WITH_ZSTD
+        return new ThreadReader(fd, new ZstdDecoder(), magic, len);
+#else
+        fprintf(stderr, "error: zstd compressed trace, but built without zstd\n");
+        return nullptr;
+#endif
+    }
+    if (n == LZ4_MAGIC) {
+#ifdef WITH_LZ4
+        return new ThreadReader(fd, new Lz4Decoder(), magic, len);
+#else
+        fprintf(stderr, "error: lz4 compressed trace, but built without lz4\n");
+        return nullptr;
+#endif
+    }
+    return new FdReader(fd, magic, len);
+}
+
+Reader* reader_map(int fd) {
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || !S_ISREG(st.st_mode) || (st.st_size < 4)) {
+        return nullptr;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    uint8_t* magic = (uint8_t*) p;
+    uint32_t n = magic[0] | (magic[1] << 8) | (magic[2] << 16) | ((uint32_t)magic[3] << 24);
+    if (reader_compressed(n)) {
+        munmap(p, st.st_size);
+        return nullptr;
+    }
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    return new MapReader(magic, st.st_size);
+}
+
+};
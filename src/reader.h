@@ -0,0 +1,44 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace tv {
+
+// Sequential byte source for the importer.
+// Input is consumed in large blocks rather than record by record.
+struct Reader {
+    uint8_t* cur;
+    size_t avail;
+
+    Reader() : cur(nullptr), avail(0) {}
+    virtual ~Reader() {}
+
+    // read len bytes, returns fewer only at the end of input
+    size_t read(void* data, size_t len);
+
+    // make the next block of input available in cur/avail,
+    // returns false at the end of input
+    virtual bool fill() = 0;
+};
+
+// Detect the input format from its first bytes and return a reader
+// for it: raw ktrace, or zstd / lz4 framed ktrace which is decompressed
+// on a separate thread.  The fd is not closed by the reader.
+Reader* reader_open(int fd);
+
+// Whether the first four bytes of a file, read little endian, start a
+// zstd or lz4 frame.
+bool reader_compressed(uint32_t magic);
+
+// Map an uncompressed trace whole, for importers that read it more
+// than once. Returns nullptr for compressed input or anything that is
+// not a regular file.  Reads from the start of the file, whatever the
+// fd's offset, and the fd may be closed afterwards.
+Reader* reader_map(int fd);
+
+};
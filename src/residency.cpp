@@ -0,0 +1,150 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "traceviz.h"
+
+namespace tv {
+
+static void build_track(Track* t, std::vector<ResidencyKey>& keys) {
+    // (state, cpu) -> slot in keys, 0 for none yet
+    uint16_t slots[(TS_LAST + 1) * 256];
+    memset(slots, 0, sizeof(slots));
+
+    keys.clear();
+    size_t count = t->task.size();
+    for (size_t n = 0; n < count; n++) {
+        const TaskState& task = t->task[n];
+        unsigned state = std::min((unsigned) task.state, (unsigned) TS_LAST);
+        uint16_t& slot = slots[state * 256 + task.cpu];
+        if (slot == 0) {
+            keys.push_back(ResidencyKey());
+            keys.back().state = state;
+            keys.back().cpu = task.cpu;
+            keys.back().cum.push_back(0);
+            slot = keys.size();
+        }
+        // the final state of a track has no end, so no duration
+        int64_t dur = ((n + 1) < count) ? (t->task[n + 1].ts - task.ts) : 0;
+        ResidencyKey& key = keys[slot - 1];
+        key.idx.push_back(n);
+        key.cum.push_back(key.cum.back() + dur);
+    }
+}
+
+// Tracks are independent, so they are split across worker threads.
+// Paged columns fault chunks in through a shared pager, so those are
+// built on this thread, a track at a time.
+void ResidencyIndex::build(Trace& trace, unsigned nthreads) {
+    tracks.clear();
+    tracks.resize(trace.tracks.size());
+    tmin = 0x7FFFFFFFFFFFFFFFL;
+    tmax = -0x7FFFFFFFFFFFFFFFL;
+
+    if (trace.pager != nullptr) {
+        for (Track* t : trace.tracks) {
+            build_track(t, tracks[t->idx]);
+            column_tick();
+        }
+    } else {
+        std::atomic<size_t> next(0);
+        auto work = [&]() {
+            size_t n;
+            while ((n = next++) < trace.tracks.size()) {
+                build_track(trace.tracks[n], tracks[n]);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned n = 1; n < nthreads; n++) {
+            workers.push_back(std::thread(work));
+        }
+        work();
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    for (Track* t : trace.tracks) {
+        if (t->task.size()) {
+            tmin = std::min(tmin, t->task[0].ts);
+            tmax = std::max(tmax, t->task.back().ts);
+        }
+    }
+}
+
+static inline void add_time(ResidencyReport& out, Track* t, unsigned state,
+                            unsigned cpu, int64_t dur) {
+    out.threads[t->idx].time[state] += dur;
+    if (cpu < MAXCPU) {
+        out.cpus[cpu].time[state] += dur;
+    }
+}
+
+// task n clipped to [t0,t1)
+static void add_partial(ResidencyReport& out, Track* t, size_t n, int64_t t0, int64_t t1) {
+    const TaskState& task = t->task[n];
+    if ((n + 1) >= t->task.size()) {
+        return;
+    }
+    int64_t start = std::max(task.ts, t0);
+    int64_t end = std::min(t->task[n + 1].ts, t1);
+    if (end > start) {
+        add_time(out, t, std::min((unsigned) task.state, (unsigned) TS_LAST), task.cpu, end - start);
+    }
+}
+
+void ResidencyIndex::query(Trace& trace, int64_t t0, int64_t t1, ResidencyReport& out) {
+    out.t0 = std::max(t0, tmin);
+    out.t1 = std::min(t1, tmax);
+    out.threads.assign(trace.tracks.size(), Residency());
+    memset(out.cpus, 0, sizeof(out.cpus));
+
+    for (Track* t : trace.tracks) {
+        auto begin = t->task.begin();
+        auto end = t->task.end();
+        if (begin == end) {
+            continue;
+        }
+        // states starting in [t0,t1), all but the last of which end
+        // inside the range too, plus the state running at t0
+        size_t i0 = std::lower_bound(begin, end, t0) - begin;
+        size_t i1 = std::lower_bound(begin, end, t1) - begin;
+        if (i0 > 0) {
+            add_partial(out, t, i0 - 1, t0, t1);
+        }
+        if (i1 > i0) {
+            add_partial(out, t, i1 - 1, t0, t1);
+        }
+        if ((i1 - i0) < 2) {
+            continue;
+        }
+        uint32_t first = i0;
+        uint32_t last = i1 - 1;
+        for (auto& key : tracks[t->idx]) {
+            size_t lo = std::lower_bound(key.idx.begin(), key.idx.end(), first) - key.idx.begin();
+            size_t hi = std::lower_bound(key.idx.begin() + lo, key.idx.end(), last) - key.idx.begin();
+            if (hi > lo) {
+                add_time(out, t, key.state, key.cpu, key.cum[hi] - key.cum[lo]);
+            }
+        }
+    }
+
+    out.groups.clear();
+    for (Group* g = trace.get_groups(); g != nullptr; g = g->next) {
+        out.groups.push_back(Residency());
+        Residency& r = out.groups.back();
+        for (Track* t = g->first; t != nullptr; t = t->next) {
+            for (unsigned n = 0; n <= TS_LAST; n++) {
+                r.time[n] += out.threads[t->idx].time[n];
+            }
+        }
+    }
+}
+
+};
@@ -0,0 +1,112 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "traceviz.h"
+
+namespace tv {
+
+template <typename T>
+static size_t vector_bytes(const std::vector<T>& v) {
+    return v.capacity() * sizeof(T);
+}
+
+size_t Trace::memory(void) {
+    size_t total = 0;
+    for (Track* t : tracks) {
+        total += sizeof(Track) + t->task.bytes() + t->event.bytes();
+    }
+    for (auto& q : waitqs.queues) {
+        total += sizeof(q) + vector_bytes(q.blockers) + vector_bytes(q.wakers);
+    }
+    for (auto& it : tag_index) {
+        const TagIndex& ti = it.second;
+        total += vector_bytes(ti.ts) + vector_bytes(ti.refs) +
+                 vector_bytes(ti.by_track) + vector_bytes(ti.cum_a);
+    }
+    for (auto& it : syscall_index) {
+        const TagIndex& ti = it.second;
+        total += vector_bytes(ti.ts) + vector_bytes(ti.refs) + vector_bytes(ti.by_track);
+    }
+    for (auto& keys : residency.tracks) {
+        for (auto& key : keys) {
+            total += sizeof(key) + vector_bytes(key.idx) + vector_bytes(key.cum);
+        }
+    }
+    for (auto& list : probes.spans) {
+        total += vector_bytes(list);
+    }
+    total += vector_bytes(probes.pairs) + vector_bytes(probes.longest);
+    for (auto& lod : task_lod.levels) {
+        for (auto& level : lod) {
+            total += sizeof(level) + vector_bytes(level.runs);
+        }
+    }
+    total += vector_bytes(overview.busy) + vector_bytes(overview.events);
+    for (auto& c : counters) {
+        for (unsigned n = 0; n < c.min.size(); n++) {
+            total += vector_bytes(c.min[n]) + vector_bytes(c.max[n]);
+        }
+    }
+    return total;
+}
+
+int Session::import(const std::vector<const char*>& paths, const ImportOptions& opt) {
+    // the cores are shared out between the imports running at once, so
+    // each one builds its indexes on its share
+    unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t count = std::min((size_t) cores, paths.size());
+    unsigned share = count ? std::max(cores / (unsigned) count, 1u) : cores;
+    size_t first = traces.size();
+    for (const char* path : paths) {
+        Trace* trace = new Trace();
+        trace->options = opt;
+        trace->options.threads = share;
+        trace->names = &names;
+        trace->source = path;
+        traces.push_back(trace);
+    }
+
+    // traces share nothing while importing but the name pool (and the
+    // column page pool), both of which lock; each worker takes the next
+    // path not yet taken, so no more run than there are cores
+    std::vector<int> status(paths.size(), 0);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (size_t n = 0; n < count; n++) {
+        workers.push_back(std::thread([this, &status, &next, first]() {
+            size_t n;
+            while ((n = next++) < status.size()) {
+                Trace* trace = traces[first + n];
+                status[n] = trace->import(trace->source);
+            }
+        }));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // a failed trace is left half built, so it is not shown at all
+    int failed = 0;
+    size_t kept = first;
+    for (size_t n = 0; n < paths.size(); n++) {
+        Trace* trace = traces[first + n];
+        if (status[n]) {
+            fprintf(stderr, "error: cannot import '%s'\n", paths[n]);
+            delete trace;
+            failed++;
+        } else {
+            traces[kept++] = trace;
+        }
+    }
+    traces.resize(kept);
+    return failed;
+}
+
+};
@@ -0,0 +1,144 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "traceviz.h"
+
+namespace tv {
+
+// tracks with fewer task states than this draw them all at any zoom
+#define TASK_LOD_MIN_STATES 1024
+// no level is finer than TASK_LOD_MIN_NS, nor so fine that the trace
+// spans more than TASK_LOD_MAX_BUCKETS of its buckets; a busy track
+// starts coarser still, at its mean spacing of states (see build())
+#define TASK_LOD_MIN_NS 64
+#define TASK_LOD_MAX_BUCKETS (1 << 22)
+
+int TaskLod::level_for(uint16_t trackidx, double ns) const {
+    if ((trackidx >= levels.size()) || levels[trackidx].empty() ||
+        (levels[trackidx][0].width > ns)) {
+        return -1;
+    }
+    const std::vector<TaskLodLevel>& lod = levels[trackidx];
+    unsigned level = 0;
+    while (((level + 1) < lod.size()) && (lod[level + 1].width <= ns)) {
+        level++;
+    }
+    return level;
+}
+
+static inline uint8_t lod_state(uint8_t state) {
+    return (state <= TS_LAST) ? state : TS_NONE;
+}
+
+static void emit(std::vector<TaskState>& out, int64_t ts, uint8_t state) {
+    if (out.empty() || (out.back().state != state)) {
+        TaskState s;
+        s.ts = ts;
+        s.state = state;
+        s.cpu = 0;
+        out.push_back(s);
+    }
+}
+
+// Cut the states in into buckets w wide from t0, each taking the state
+// it held longest. A state's time runs to the next one's start and the
+// last one ends the trace at tend. Buckets inside one long state are
+// skipped over, so the work is in the states, not the buckets.
+template <typename C>
+static void coarsen(const C& in, int64_t t0, int64_t w, int64_t tend,
+                    std::vector<TaskState>& out) {
+    int64_t dur[TS_LAST + 1];
+    size_t n = in.size();
+    size_t i = 0;
+    size_t buckets = 0;
+    out.clear();
+    while (i < n) {
+        int64_t bstart = t0 + ((in[i].ts - t0) / w) * w;
+        int64_t bend = bstart + w;
+        memset(dur, 0, sizeof(dur));
+        uint8_t cur = (i > 0) ? lod_state(in[i - 1].state) : TS_NONE;
+        int64_t at = bstart;
+        while ((i < n) && (in[i].ts < bend)) {
+            dur[cur] += in[i].ts - at;
+            at = in[i].ts;
+            cur = lod_state(in[i].state);
+            i++;
+        }
+        dur[cur] += std::min(bend, tend) - at;
+        uint8_t best = cur;
+        for (uint8_t s = 0; s <= TS_LAST; s++) {
+            if (dur[s] > dur[best]) {
+                best = s;
+            }
+        }
+        emit(out, bstart, best);
+
+        // the buckets up to the next state's are all cur
+        int64_t next = (i < n) ? in[i].ts : tend;
+        if (next >= (bend + w)) {
+            emit(out, bend, cur);
+        }
+        if ((++buckets & 0xFFFF) == 0) {
+            column_tick();
+        }
+    }
+    if (!out.empty() && (out.back().ts < tend)) {
+        TaskState s = out.back();
+        s.ts = tend;
+        out.push_back(s);
+    }
+}
+
+// Each level is twice as coarse as the one before and comes from it,
+// the first from the task states, until one is small enough to draw
+// whole. Only levels with at most half the entries of the last one kept
+// (or of the task states) are worth keeping.
+void TaskLod::build(Trace& trace) {
+    levels.assign(trace.tracks.size(), std::vector<TaskLodLevel>());
+    t0 = trace.residency.tmin;
+    if (trace.residency.tmin > trace.residency.tmax) {
+        return;
+    }
+    int64_t span = trace.residency.tmax - trace.residency.tmin + 1;
+    int64_t width = std::max((int64_t) TASK_LOD_MIN_NS,
+                             (span + TASK_LOD_MAX_BUCKETS - 1) / TASK_LOD_MAX_BUCKETS);
+
+    std::vector<TaskState> prev;
+    std::vector<TaskState> next;
+    for (Track* t : trace.tracks) {
+        if (t->task.size() < TASK_LOD_MIN_STATES) {
+            continue;
+        }
+        std::vector<TaskLodLevel>& lod = levels[t->idx];
+        int64_t tend = t->task.back().ts;
+        size_t kept = t->task.size();
+
+        // buckets finer than the states are apart on average keep
+        // about as many entries as there are states, so start coarser
+        int64_t w = width;
+        while ((w * (int64_t) kept) < (tend - t->task[0].ts)) {
+            w <<= 1;
+        }
+        coarsen(t->task, t0, w, tend, next);
+        for (; ; w <<= 1) {
+            if ((next.size() * 2) <= kept) {
+                kept = next.size();
+                lod.push_back(TaskLodLevel());
+                lod.back().width = w;
+                lod.back().runs = next;
+            }
+            if ((next.size() <= TASK_LOD_MIN_STATES) || (w >= span)) {
+                break;
+            }
+            prev.swap(next);
+            coarsen(prev, t0, w << 1, tend, next);
+        }
+    }
+}
+
+};
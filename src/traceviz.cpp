@@ -2,8 +2,15 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <dirent.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
 
 #define IMGUI_DEFINE_MATH_OPERATORS
 
@@ -21,8 +28,6 @@ using tv::Track;
 using tv::Event;
 using tv::TaskState;
 
-Trace TheTrace;
-
 #define KTRACE_DEF(num,type,name,group) case num: return #name;
 
 const char* evtname(uint32_t evt) {
@@ -65,54 +70,55 @@ const char* irqname(uint32_t irqn) {
     }
 }
 
-void EventTooltip(Trace& trace, Event* evt) {
+// describe an event, possibly across several lines
+const char* EventText(Trace& trace, Event* evt, char* buf, size_t len) {
     switch (evt->tag) {
     case EVT_CHANNEL_READ:
     case EVT_CHANNEL_WRITE:
-        ImGui::SetTooltip("%s\nbytes = %u\nhandles = %u",
-                          evtname(evt->tag), evt->a, evt->b);
+        snprintf(buf, len, "%s\nbytes = %u\nhandles = %u",
+                 evtname(evt->tag), evt->a, evt->b);
         break;
     case EVT_IRQ_ENTER:
     case EVT_IRQ_EXIT: {
         const char* name = irqname(evt->b);
         const char* str = (evt->tag == EVT_IRQ_ENTER) ? "IRQ ENTER" : "IRQ EXIT";
         if (name) {
-            ImGui::SetTooltip("%s %d %s", str, evt->b, name);
+            snprintf(buf, len, "%s %d %s", str, evt->b, name);
         } else {
-            ImGui::SetTooltip("%s %d", str, evt->b);
+            snprintf(buf, len, "%s %d", str, evt->b);
         }
         break;
     }
     case EVT_PAGE_FAULT:
-        ImGui::SetTooltip("PAGE FAULT 0x%lx 0x%x", ((uint64_t)evt->a << 32) | evt->b, evt->c);
+        snprintf(buf, len, "PAGE FAULT 0x%lx 0x%x", ((uint64_t)evt->a << 32) | evt->b, evt->c);
         break;
     case EVT_PAGE_FAULT_EXIT:
-        ImGui::SetTooltip("PAGE FAULT EXIT 0x%lx 0x%x", ((uint64_t)evt->a << 32) | evt->b, evt->c);
+        snprintf(buf, len, "PAGE FAULT EXIT 0x%lx 0x%x", ((uint64_t)evt->a << 32) | evt->b, evt->c);
         break;
     case EVT_KWAIT_BLOCK:
-        ImGui::SetTooltip("KWAIT BLOCK 0x%lx", ((uint64_t)evt->a << 32) | evt->b);
+        snprintf(buf, len, "KWAIT BLOCK 0x%lx", ((uint64_t)evt->a << 32) | evt->b);
         break;
     case EVT_KWAIT_UNBLOCK:
-        ImGui::SetTooltip("KWAIT UNBLOCK 0x%lx 0x%x", ((uint64_t)evt->a << 32) | evt->b, evt->c);
+        snprintf(buf, len, "KWAIT UNBLOCK 0x%lx 0x%x", ((uint64_t)evt->a << 32) | evt->b, evt->c);
         break;
     case EVT_KWAIT_WAKE:
-        ImGui::SetTooltip("KWAIT WAKE 0x%lx is_mutex %d", ((uint64_t)evt->a << 32) | evt->b, evt->c);
+        snprintf(buf, len, "KWAIT WAKE 0x%lx is_mutex %d", ((uint64_t)evt->a << 32) | evt->b, evt->c);
         break;
     case EVT_SYSCALL_ENTER: {
         const char* name = trace.syscall_name(evt->a);
         if (name) {
-            ImGui::SetTooltip("SYSCALL %s()", name);
+            snprintf(buf, len, "SYSCALL %s()", name);
         } else {
-            ImGui::SetTooltip("SYSCALL sys_%u()", evt->a);
+            snprintf(buf, len, "SYSCALL sys_%u()", evt->a);
         }
         break;
     }
     case EVT_SYSCALL_EXIT: {
         const char* name = trace.syscall_name(evt->a);
         if (name) {
-            ImGui::SetTooltip("SYSRETN %s()", name);
+            snprintf(buf, len, "SYSRETN %s()", name);
         } else {
-            ImGui::SetTooltip("SYSRETN sys_%u()", evt->a);
+            snprintf(buf, len, "SYSRETN sys_%u()", evt->a);
         }
         break;
     }
@@ -120,73 +126,43 @@ void EventTooltip(Trace& trace, Event* evt) {
         if (evt->tag >= EVT_PROBE) {
             const char* name = trace.probe_name(evt->tag);
             if (name) {
-                ImGui::SetTooltip("PROBE %s\n%u\n%u", name, evt->a, evt->b);
+                snprintf(buf, len, "PROBE %s\n%u\n%u", name, evt->a, evt->b);
             } else {
-                ImGui::SetTooltip("PROBE %03x\n%u\n%u", evt->tag, evt->a, evt->b);
+                snprintf(buf, len, "PROBE %03x\n%u\n%u", evt->tag, evt->a, evt->b);
             }
             break;
         }
-        ImGui::SetTooltip("%s", evtname(evt->tag));
+        snprintf(buf, len, "%s", evtname(evt->tag));
         break;
     }
+    return buf;
+}
+
+void EventTooltip(Trace& trace, Event* evt) {
+    char tmp[256];
+    ImGui::SetTooltip("%s", EventText(trace, evt, tmp, sizeof(tmp)));
 }
 
 static ImU32 task_state_color[TS_LAST + 1];
 
-static const char *task_state_name[TS_LAST + 1] = {
-    "Suspended",
-    "Ready",
-    "Running",
-    "Blocked",
-    "Sleeping",
-    "Dead",
-    "None",
-};
-static float task_float_color[3 * (TS_LAST + 1)];
+// draws task states on the GPU, if the backend offers it
+static TrackRenderer* track_renderer = nullptr;
 
-struct {
-    int64_t scale;
-    int64_t div;
-    const char* unit;
-} zoom[] = {
-    { 1,           1,          "ns" },
-    { 2,           1,          "ns" },
-    { 5,           1,          "ns" },
-    { 10,          1000,       "us" },
-    { 20,          1000,       "us" },
-    { 50,          1000,       "us" },
-    { 100,         1000,       "us" },
-    { 200,         1000,       "us" },
-    { 500,         1000,       "us" },
-    { 1000,        1000,       "us" },
-    { 2000,        1000,       "us" },
-    { 5000,        1000,       "us" },
-    { 10000,       1000000,    "ms" },
-    { 20000,       1000000,    "ms" },
-    { 50000,       1000000,    "ms" },
-    { 100000,      1000000,    "ms" },
-    { 200000,      1000000,    "ms" },
-    { 500000,      1000000,    "ms" },
-    { 1000000,     1000000,    "ms" },
-    { 2000000,     1000000,    "ms" },
-    { 5000000,     1000000,    "ms" },
-    { 10000000,    1000000000, "s" },
-    { 20000000,    1000000000, "s" },
-    { 50000000,    1000000000, "s" },
-#if 0
-    { 100000000,   1000000000, "s" },
-    { 200000000,   1000000000, "s" },
-    { 500000000,   1000000000, "s" },
-    { 1000000000,  1000000000, "s" },
-#endif
-};
+void traceviz_set_track_renderer(TrackRenderer* r) {
+    track_renderer = r;
+}
 
-#define ZOOMMAX ((sizeof(zoom)/sizeof(zoom[0])) - 1)
-#define ZOOMDEF 19
-static unsigned zoomno = ZOOMDEF;
+static float task_float_color[3 * (TS_LAST + 1)];
 
-static int64_t drag_offset = 0;
-static int64_t tpos = 0; // time at left edge
+// ns per horizontal pixel, which W/S and the mouse wheel scale by
+// ZOOM_STEP (or a power of it), so it need not be whole
+#define ZOOM_DEF 2000000.0
+#define ZOOM_MIN (1.0 / 64)
+#define ZOOM_STEP 1.25
+static double zoom = ZOOM_DEF;
+
+static double drag_offset = 0;
+static double tpos = 0; // time at left edge, may fall between ns
 
 static ImFont* symbols;
 
@@ -196,6 +172,23 @@ static inline float distish(const ImVec2& a, const ImVec2& b) {
     return dx * dx + dy * dy;
 }
 
+// format an interval for display, buffer must hold 48 bytes
+static const char* fmt_duration(char* tmp, int64_t n) {
+    if (n < 0) {
+        n = -n;
+    }
+    if (n > 1000000000L) {
+        sprintf(tmp, "%ld.%06ld s", n / 1000000000L, (n % 1000000000L) / 1000L);
+    } else if (n > 1000000) {
+        sprintf(tmp, "%ld.%06ld ms", n / 1000000L, n % 1000000L);
+    } else if (n > 1000) {
+        sprintf(tmp, "%ld.%03ld us", n / 1000L, n % 1000L);
+    } else {
+        sprintf(tmp, "%ld ns", n);
+    }
+    return tmp;
+}
+
 static ImColor colorify(uint32_t tag) {
     uint32_t bits = tag * 157;
     bits ^= bits >> 8;
@@ -218,91 +211,348 @@ static bool show_probes = true;
 static bool show_help_window = false;
 static bool show_flow = true;
 static bool show_evts = true;
+static bool show_counters = true;
+static bool show_waitq_window = false;
+static bool show_query_window = false;
+static bool show_residency_window = false;
+static bool show_mark_window = true;
+static bool show_session_window = false;
+static bool show_critpath_window = false;
+static bool show_probes_window = false;
+
+// wait queue selected in the Wait Queues window, 0 if none
+static uint64_t sel_waitq = 0;
+
+// Geometry for something that rarely changes (labels, the name
+// column), captured from the draw list the first time it is drawn and
+// copied back on later frames for as long as its key stays the same.
+struct DrawCache {
+    uint64_t key;
+    bool valid;
+    ImVec2 at;     // where it was drawn
+    int vtx0;      // draw list sizes when the capture began
+    int idx0;
+    unsigned base; // vertex index of vtx[0] then
+    std::vector<ImDrawVert> vtx;
+    std::vector<ImDrawIdx> idx; // relative to vtx[0]
+
+    DrawCache() : key(0), valid(false) {}
+
+    // Append the cached geometry, moved from where it was drawn to at,
+    // and return true. If key has changed, begin a capture instead: the
+    // caller draws at at and then calls end().
+    bool replay(ImDrawList* dl, uint64_t key, ImVec2 at);
+    void end(ImDrawList* dl);
+};
+
+// FNV-1a over the values that decide what a cache holds
+static uint64_t cache_key(const int64_t* v, unsigned n) {
+    uint64_t h = 0xcbf29ce484222325UL;
+    for (unsigned i = 0; i < n; i++) {
+        h = (h ^ (uint64_t) v[i]) * 0x100000001b3UL;
+    }
+    return h;
+}
+
+bool DrawCache::replay(ImDrawList* dl, uint64_t k, ImVec2 pos) {
+    if (valid && (key == k)) {
+        ImVec2 d = pos - at;
+        dl->PrimReserve(idx.size(), vtx.size());
+        unsigned first = dl->_VtxCurrentIdx;
+        for (const ImDrawVert& v : vtx) {
+            dl->PrimWriteVtx(v.pos + d, v.uv, v.col);
+        }
+        for (ImDrawIdx i : idx) {
+            dl->PrimWriteIdx(first + i);
+        }
+        return true;
+    }
+    key = k;
+    valid = false;
+    at = pos;
+    vtx0 = dl->VtxBuffer.Size;
+    idx0 = dl->IdxBuffer.Size;
+    base = dl->_VtxCurrentIdx;
+    return false;
+}
+
+void DrawCache::end(ImDrawList* dl) {
+    vtx.assign(dl->VtxBuffer.Data + vtx0, dl->VtxBuffer.Data + dl->VtxBuffer.Size);
+    idx.assign(dl->IdxBuffer.Data + idx0, dl->IdxBuffer.Data + dl->IdxBuffer.Size);
+    for (ImDrawIdx& i : idx) {
+        i -= base;
+    }
+    valid = true;
+}
+
+// A loaded trace and what its timeline remembers between frames.
+// Diff mode stacks two of these, baseline first, sharing one time
+// axis so they scroll and zoom in lockstep.
+struct TraceState {
+    Trace* trace;
+
+    // this trace's time at the shared view time 0; tpos, the marks and
+    // view_t0/t1 are in the first trace's time, whose offset is 0
+    int64_t offset;
+
+    // unfolded tracks in the order (and so increasing y) they were laid out
+    std::vector<Track*> track_layout;
+
+    // track selected by clicking its name
+    Track* sel_track;
+
+    // event found by the last next/previous search
+    bool nav_valid;
+    tv::EventRef nav_ref;
+
+    // blocking chain behind an event, extended a few hops per frame
+    tv::CriticalPath crit;
+
+    // ruler labels, mark readout, and the name column
+    DrawCache ruler_text;
+    DrawCache mark_text;
+    DrawCache groups_drawn;
+    DrawCache names_drawn;
+    DrawCache overview_drawn;
+
+    int64_t prev_view_t0;
+};
+
+static tv::Session session;
+static std::vector<TraceState> views;
+
+// the trace the other windows look at
+#define MAIN_TRACE (*views[0].trace)
+
+// the view whose overview strip the mouse is dragging, and where in the
+// outline of the visible part it took hold
+static TraceState* overview_drag = nullptr;
+static float overview_grab;
+
+static bool diff_mode = false;
+static bool show_diff_window = true;
+static tv::TraceDiff trace_diff;
+
+// time range visible in the last frame, in the first trace's time
+static int64_t view_t0;
+static int64_t view_t1;
+
+// zoom and left edge for this frame, see ViewControls()
+static double frame_tscale;
+static double frame_tsedge;
+static bool frame_collapse;
 
 static bool is_marking = false;
 static int64_t mark0_pos;
 static int64_t mark1_pos;
 static bool is_collapsed = false;
 
-void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
-    Group* groups = trace.get_groups();
-    auto red = ImColor(255,0,0);
-    auto fg = ImColor(0,0,0);
-    auto grid = ImColor(100,100,100);
-    auto dl = ImGui::GetWindowDrawList();
-    ImGuiIO& io = ImGui::GetIO();
-    float tick = 20.0;
+// Drawing Constants
+#define W_NAMES 200
+#define H_TICK  20
+#define Y_TICK  15
+#define H_RULER 22
+#define H_GROUP 20
+#define H_TRACE 18
+#define H_COUNTER 28
+
+// hit-test radius for event glyphs, in pixels
+#define HIT_RADIUS 12.0
+// snap distance for marking, in pixels
+#define SNAP_DIST 8.0
+
+// map a screen y coordinate to the track drawn there
+static Track* TrackAt(TraceState& v, float y) {
+    auto it = std::upper_bound(v.track_layout.begin(), v.track_layout.end(), y,
+                               [](float y, Track* t) { return y < t->y; });
+    if (it == v.track_layout.begin()) {
+        return nullptr;
+    }
+    Track* t = *(--it);
+    return (y < (t->y + H_TRACE)) ? t : nullptr;
+}
 
-    bool zoomed = false;
-    int64_t oldscale = zoom[zoomno].scale;
-    if (ImGui::IsKeyPressed(KEY(W), false)) {
-        if (zoomno > 0) {
-            zoomno--;
+// whether an event's glyph is drawn under the current display toggles
+static bool EventShown(const Event& e) {
+    if (e.tag >= EVT_PROBE) {
+        return show_probes;
+    }
+    switch (e.tag) {
+    case EVT_PORT_WAIT:
+    case EVT_WAIT_ONE:
+    case EVT_PORT_WAIT_DONE:
+    case EVT_WAIT_ONE_DONE:
+    case EVT_CHANNEL_CREATE:
+    case EVT_CHANNEL_WRITE:
+    case EVT_CHANNEL_READ:
+        return show_evts;
+    case EVT_SYSCALL_ENTER:
+    case EVT_SYSCALL_EXIT:
+        return show_syscalls;
+    case EVT_IRQ_ENTER:
+    case EVT_IRQ_EXIT:
+    case EVT_PAGE_FAULT:
+    case EVT_PAGE_FAULT_EXIT:
+        return show_interrupts;
+    case EVT_KWAIT_BLOCK:
+    case EVT_KWAIT_UNBLOCK:
+    case EVT_KWAIT_WAKE:
+        return show_evts || (sel_waitq && (kwait_addr(e) == sel_waitq));
+    default:
+        return false;
+    }
+}
+
+// find the shown event whose glyph is nearest the cursor on track t,
+// seeking by time and walking outward only past hidden events
+static Event* EventAt(Track* t, float x, double tsedge, double tscale, uint32_t* idx) {
+    // glyphs are drawn 16px wide starting at the event time
+    int64_t ts = (int64_t) (tsedge + (x - 8.0) * tscale);
+    int64_t range = (int64_t)(HIT_RADIUS * tscale);
+    auto begin = t->event.begin();
+    auto end = t->event.end();
+    auto mid = std::lower_bound(begin, end, ts);
+    Event* best = nullptr;
+    int64_t best_dist = range + 1;
+    for (auto e = mid; (e != end) && ((e->ts - ts) < best_dist); ++e) {
+        if (EventShown(*e)) {
+            best = &(*e);
+            *idx = e - begin;
+            best_dist = e->ts - ts;
+            break;
         }
-        zoomed = true;
     }
-    if (ImGui::IsKeyPressed(KEY(S), false)) {
-        if (zoomno < ZOOMMAX) {
-            zoomno++;
+    for (auto e = mid; (e != begin) && ((ts - (e - 1)->ts) < best_dist); ) {
+        --e;
+        if (EventShown(*e)) {
+            best = &(*e);
+            *idx = e - begin;
+            break;
         }
-        zoomed = true;
     }
+    return best;
+}
 
-    if (ImGui::IsKeyPressed(KEY(0), false)) {
-        zoomno = ZOOMDEF;
-        tpos = TheTrace.first_timestamp;
+// find the task state transition nearest ts on track t
+static int64_t TransitionNear(Track* t, int64_t ts, int64_t* dist) {
+    auto begin = t->task.begin();
+    auto end = t->task.end();
+    auto task = std::lower_bound(begin, end, ts);
+    int64_t best = ts;
+    *dist = 0x7FFFFFFFFFFFFFFFL;
+    if (task != end) {
+        best = task->ts;
+        *dist = task->ts - ts;
     }
+    if ((task != begin) && ((ts - (task - 1)->ts) < *dist)) {
+        best = (task - 1)->ts;
+        *dist = ts - best;
+    }
+    return best;
+}
 
-    // tscale: nanoseconds per horizontal pixel
-    // tdiv: divisor for nanoseconds to units
-    int64_t tscale = zoom[zoomno].scale;
-    int64_t tdiv = zoom[zoomno].div;
-    const char* tunit = zoom[zoomno].unit;
+// keyboard shortcuts for the trace view, ignored while typing into a widget
+// what the views and windows that follow the per-event indexes say on
+// a paged native file, which is opened without them
+static const char* not_indexed_text =
+    "Not available for a paged .tvz file, which is opened "
+    "without indexing its events. Open the ktrace file instead.";
+
+// seconds left to show not_indexed_text by the mouse, after a key
+// that needs the indexes was pressed over a paged trace
+#define NOTICE_SECONDS 2.0f
+static float not_indexed_notice = 0;
+
+static bool ViewKeyPressed(int key, bool repeat = true) {
+    return !ImGui::GetIO().WantTextInput && ImGui::IsKeyPressed(key, repeat);
+}
+
+static bool ViewKeyDown(int key) {
+    return !ImGui::GetIO().WantTextInput && ImGui::IsKeyDown(key);
+}
+
+// keys and mouse gestures that move the time axis, once per frame
+// however many traces are shown
+void ViewControls(ImVec2 origin, ImVec2 content) {
+    ImGuiIO& io = ImGui::GetIO();
+
+    double oldzoom = zoom;
+    if (ViewKeyPressed(KEY(W))) {
+        zoom /= ZOOM_STEP;
+    }
+    if (ViewKeyPressed(KEY(S))) {
+        zoom *= ZOOM_STEP;
+    }
+    auto mpos = ImGui::GetMousePos();
+    mpos -= origin + ImVec2(W_NAMES, 0);
+    bool over = (mpos.x >= 0) && (mpos.x < content.x) && ImGui::IsWindowHovered();
+    if (over && (io.MouseWheel != 0)) {
+        zoom *= pow(ZOOM_STEP, -io.MouseWheel);
+    }
 
-    if (zoomed) {
-        auto mpos = ImGui::GetMousePos();
-        mpos -= origin + ImVec2(200, 0);
-        if ((mpos.x >= 0) && (mpos.x < content.x)) {
-            // if cursor is over window, compensate for zoom
-            tpos = tpos + (oldscale * mpos.x) - (tscale * mpos.x);
+    // from a fraction of a ns per pixel out to twice all the traces,
+    // each placed at its offset
+    int64_t tmin = 0x7FFFFFFFFFFFFFFFL;
+    int64_t tmax = -0x7FFFFFFFFFFFFFFFL;
+    for (const TraceState& v : views) {
+        const Trace& trace = *v.trace;
+        if (trace.residency.tmin <= trace.residency.tmax) {
+            tmin = std::min(tmin, trace.residency.tmin - v.offset);
+            tmax = std::max(tmax, trace.residency.tmax - v.offset);
         }
     }
+    double span = (tmin < tmax) ? (double) (tmax - tmin) : 0.0;
+    double zmax = std::max(ZOOM_DEF, 2.0 * span / std::max(content.x - W_NAMES, 1.0f));
+    zoom = std::min(std::max(zoom, ZOOM_MIN), zmax);
+
+    if (ViewKeyPressed(KEY(0), false)) {
+        zoom = ZOOM_DEF;
+        tpos = (tmin <= tmax) ? tmin : 0;
+    } else if (over) {
+        // if cursor is over window, compensate for zoom
+        tpos += (oldzoom - zoom) * mpos.x;
+    }
 
-    if (ImGui::IsKeyPressed(KEY(F), false)) {
+    double tscale = zoom;
+
+    if (ViewKeyPressed(KEY(F), false)) {
         show_flow = !show_flow;
         if (show_flow) {
             show_evts = true;
         }
     }
-    if (ImGui::IsKeyPressed(KEY(E), false)) {
+    if (ViewKeyPressed(KEY(E), false)) {
         show_evts = !show_evts;
     }
-    if (ImGui::IsKeyPressed(KEY(I), false)) {
+    if (ViewKeyPressed(KEY(I), false)) {
         show_interrupts = !show_interrupts;
     }
-    if (ImGui::IsKeyPressed(KEY(C), false)) {
+    if (ViewKeyPressed(KEY(C), false)) {
         show_syscalls = !show_syscalls;
     }
-    if (ImGui::IsKeyPressed(KEY(P), false)) {
+    if (ViewKeyPressed(KEY(P), false)) {
         show_probes= !show_probes;
     }
-    if (ImGui::IsKeyPressed(KEY(H), false)) {
+    if (ViewKeyPressed(KEY(H), false)) {
         show_help_window = !show_help_window;
     }
-    if (ImGui::IsKeyPressed(KEY(M), false)) {
+    if (ViewKeyPressed(KEY(G), false)) {
+        show_counters = !show_counters;
+    }
+    if (ViewKeyPressed(KEY(M), false)) {
         if (!is_marking && (mark0_pos != mark1_pos)) {
             tpos = mark0_pos;
         }
     }
-    bool do_collapse_change = false;
-    if (ImGui::IsKeyPressed(KEY(Q))) {
+    frame_collapse = false;
+    if (ViewKeyPressed(KEY(Q))) {
         is_collapsed = !is_collapsed;
-        do_collapse_change = true;
+        frame_collapse = true;
     }
-    if (ImGui::IsKeyDown(KEY(A))) {
+    if (ViewKeyDown(KEY(A))) {
         tpos -= tscale * 5;
     }
-    if (ImGui::IsKeyDown(KEY(D))) {
+    if (ViewKeyDown(KEY(D))) {
         tpos += tscale * 5;
     }
 
@@ -311,26 +561,17 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
         drag_offset = 0;
     }
 
-    int64_t tsegment = 100 * tscale;
-    int64_t tsedge = tpos;
-
-    // Drawing Constants
-#define W_NAMES 200
-#define H_TICK  20
-#define Y_TICK  15
-#define H_RULER 22
-#define H_GROUP 20
-#define H_TRACE 18
+    double tsedge = tpos;
 
     ImVec2 mouse = ImGui::GetMousePos();
-    if (ImGui::IsMouseDown(0) && ImGui::IsWindowFocused()) {
+    if (ImGui::IsMouseDown(0) && ImGui::IsWindowFocused() && (overview_drag == nullptr)) {
         if (io.KeyCtrl) {
             ImVec2 pos = origin + ImVec2(W_NAMES, 0);
             if (!is_marking) {
                 is_marking = true;
-                mark0_pos = tsedge + (int64_t) ((mouse.x - pos.x) * tscale);
+                mark0_pos = (int64_t) (tsedge + (mouse.x - pos.x) * tscale);
             }
-            mark1_pos = tsedge + (int64_t) ((mouse.x - pos.x) * tscale);
+            mark1_pos = (int64_t) (tsedge + (mouse.x - pos.x) * tscale);
         } else if (io.KeyShift) {
         } else if (io.KeyAlt) {
         } else {
@@ -344,8 +585,261 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
         }
     }
 
+    frame_tscale = tscale;
+    frame_tsedge = tsedge;
+}
+
+// draw one trace's timeline into origin/content, active if it should
+// take hovering and navigation keys
+// Rectangles and glyphs for a whole track, written to the draw list
+// under one PrimReserve() instead of one reservation (and its index
+// bookkeeping) per call. A rectangle that continues the last one in
+// the same color, as runs of task states often do, extends it instead
+// of adding a quad.
+struct QuadBatch {
+    struct Rect {
+        float x0, y0, x1, y1;
+        ImU32 col;
+    };
+    struct Glyph {
+        ImVec2 pos;
+        ImU32 col;
+        const ImFont::Glyph* glyph;
+    };
+    std::vector<Rect> rects;
+    std::vector<Glyph> glyphs;
+
+    void rect(float x0, float y0, float x1, float y1, ImU32 col) {
+        if (!rects.empty()) {
+            Rect& r = rects.back();
+            if ((r.col == col) && (r.x1 >= x0) && (r.y0 == y0) && (r.y1 == y1)) {
+                r.x1 = std::max(r.x1, x1);
+                return;
+            }
+        }
+        Rect r = { x0, y0, x1, y1, col };
+        rects.push_back(r);
+    }
+    // placed as ImFont::RenderGlyph() would
+    void glyph(const ImFont* font, ImVec2 pos, ImU32 col, const ImFont::Glyph* glyph) {
+        pos = ImVec2((float) (int) pos.x, (float) (int) pos.y) + font->DisplayOffset;
+        Glyph g = { pos, col, glyph };
+        glyphs.push_back(g);
+    }
+    // a line of text placed as ImFont::RenderText() would, but none of
+    // it culled against the clip rect
+    void text(const ImFont* font, ImVec2 pos, ImU32 col, const char* s) {
+        pos = ImVec2((float) (int) pos.x, (float) (int) pos.y) + font->DisplayOffset;
+        for (; *s; s++) {
+            const ImFont::Glyph* glyph = font->FindGlyph((unsigned char) *s);
+            if (glyph == nullptr) {
+                continue;
+            }
+            if (*s != ' ') {
+                Glyph g = { pos, col, glyph };
+                glyphs.push_back(g);
+            }
+            pos.x += glyph->XAdvance;
+        }
+    }
+    // rectangles first, then glyphs over them
+    void flush(ImDrawList* dl) {
+        size_t n = rects.size() + glyphs.size();
+        if (n == 0) {
+            return;
+        }
+        dl->PrimReserve(n * 6, n * 4);
+        for (const Rect& r : rects) {
+            dl->PrimRect(ImVec2(r.x0, r.y0), ImVec2(r.x1, r.y1), r.col);
+        }
+        for (const Glyph& g : glyphs) {
+            const ImFont::Glyph* gl = g.glyph;
+            dl->PrimRectUV(g.pos + ImVec2(gl->X0, gl->Y0), g.pos + ImVec2(gl->X1, gl->Y1),
+                           ImVec2(gl->U0, gl->V0), ImVec2(gl->U1, gl->V1), g.col);
+        }
+        rects.clear();
+        glyphs.clear();
+    }
+};
+
+static QuadBatch batch;
+
+// The ruler is cut into segments of five ticks, each segment 1, 2 or 5
+// times a power of ten ns and the shortest such at least RULER_MIN_PX
+// wide, labelled in the largest unit it is a whole number of.
+#define RULER_MIN_PX 100
+
+static int64_t RulerSegment(double tscale, int64_t* tdiv, const char** tunit) {
+    double min = RULER_MIN_PX * tscale;
+    int64_t seg = 1;
+    while ((seg < min) && ((seg * 2) < min) && ((seg * 5) < min)) {
+        seg *= 10;
+    }
+    if (seg < min) {
+        seg *= ((seg * 2) < min) ? 5 : 2;
+    }
+    if (seg < 1000) {
+        *tdiv = 1;
+        *tunit = "ns";
+    } else if (seg < 1000000) {
+        *tdiv = 1000;
+        *tunit = "us";
+    } else if (seg < 1000000000) {
+        *tdiv = 1000000;
+        *tunit = "ms";
+    } else {
+        *tdiv = 1000000000;
+        *tunit = "s";
+    }
+    return seg;
+}
+
+// paired probe spans are bars along the bottom of a track, each nesting
+// level PROBE_BAR above the last
+#define PROBE_BAR 4
+#define PROBE_DEPTH 3
+
+static float ProbeBarY(const tv::ProbeSpan& s) {
+    return H_TRACE - 2 - PROBE_BAR * (std::min((int) s.depth, PROBE_DEPTH - 1) + 1);
+}
+
+void DrawProbeSpans(ImDrawList* dl, Trace& trace, Track* t, ImVec2 pos,
+                    double tsedge, int64_t tsend, double tscale) {
+    const std::vector<tv::ProbeSpan>& spans = trace.probes.spans[t->idx];
+    int64_t from = (int64_t) tsedge - trace.probes.longest[t->idx];
+    auto s = std::lower_bound(spans.begin(), spans.end(), from,
+                              [](const tv::ProbeSpan& s, int64_t ts) { return s.t0 < ts; });
+    for (; (s != spans.end()) && (s->t0 < tsend); ++s) {
+        if (s->t1 < tsedge) {
+            continue;
+        }
+        float x0 = (std::max((double) s->t0, tsedge) - tsedge) / tscale;
+        float x1 = (std::min(s->t1, tsend) - tsedge) / tscale;
+        float y = ProbeBarY(*s);
+        dl->AddRectFilled(pos + ImVec2(x0, y), pos + ImVec2(std::max(x1, x0 + 1), y + PROBE_BAR - 1),
+                          colorify(trace.probes.pairs[s->pair].begin_tag));
+    }
+}
+
+// name and length of the span whose bar is at (y, ts) within a track
+void ProbeSpanTooltip(Trace& trace, Track* t, float y, int64_t ts) {
+    const std::vector<tv::ProbeSpan>& spans = trace.probes.spans[t->idx];
+    auto s = std::lower_bound(spans.begin(), spans.end(), ts - trace.probes.longest[t->idx],
+                              [](const tv::ProbeSpan& s, int64_t ts) { return s.t0 < ts; });
+    for (; (s != spans.end()) && (s->t0 <= ts); ++s) {
+        float bar = ProbeBarY(*s);
+        if ((s->t1 >= ts) && (y >= bar) && (y < (bar + PROBE_BAR))) {
+            char dur[48];
+            ImGui::SetTooltip("%s\n%s", trace.probes.pairs[s->pair].name,
+                              fmt_duration(dur, s->t1 - s->t0));
+            return;
+        }
+    }
+}
+
+// The whole trace squeezed into the width of the timeline, drawn from
+// its precomputed overview, with the part in view outlined. A click
+// outside the outline centers the view there, and dragging moves it.
+#define H_OVERVIEW 30
+
+void OverviewStrip(TraceState& v, ImVec2 origin, ImVec2 content, bool active) {
+    const tv::Overview& ov = v.trace->overview;
+    auto dl = ImGui::GetWindowDrawList();
+    auto fg = ImColor(0,0,0);
+    ImVec2 pos = origin + ImVec2(W_NAMES, 0);
+    float w = content.x - W_NAMES;
+    if ((w < 1) || (ov.t1 <= ov.t0)) {
+        return;
+    }
+    // nanoseconds per pixel of the strip
+    double tscale = (ov.t1 - ov.t0) / (double) w;
+
+    // only the width decides what is drawn, the summary never changes
+    int64_t key[3] = { (int64_t) w, ov.t0, ov.t1 };
+    if (!v.overview_drawn.replay(dl, cache_key(key, 3), pos)) {
+        auto busy_color = ImColor(140,200,120);
+        auto events_color = ImColor(60,120,200);
+        float bottom = pos.y + H_OVERVIEW - 1;
+        float bscale = (ov.busy_max > 0) ? ((H_OVERVIEW - 3) / ov.busy_max) : 0;
+        float escale = (ov.events_max > 0) ? ((H_OVERVIEW - 3) / (float) ov.events_max) : 0;
+        std::vector<ImVec2> line;
+        for (float x = 0; x < w; x += 1) {
+            // the busiest of the buckets under a pixel
+            size_t b0 = (size_t) (x * OVERVIEW_BUCKETS / w);
+            size_t b1 = std::max(b0 + 1, (size_t) ((x + 1) * OVERVIEW_BUCKETS / w));
+            float busy = 0;
+            uint32_t events = 0;
+            for (size_t b = b0; (b < b1) && (b < OVERVIEW_BUCKETS); b++) {
+                busy = std::max(busy, ov.busy[b]);
+                events = std::max(events, ov.events[b]);
+            }
+            if (busy > 0) {
+                dl->AddLine(ImVec2(pos.x + x, bottom - busy * bscale), ImVec2(pos.x + x, bottom),
+                            busy_color);
+            }
+            line.push_back(ImVec2(pos.x + x + 0.5f, bottom - events * escale));
+        }
+        dl->AddPolyline(line.data(), line.size(), events_color, false, 1.0f, true);
+        dl->AddLine(ImVec2(pos.x, bottom), ImVec2(pos.x + w, bottom), fg);
+        v.overview_drawn.end(dl);
+    }
+
+    float vx0 = (frame_tsedge + v.offset - ov.t0) / tscale;
+    float vx1 = vx0 + w * frame_tscale / tscale;
+    ImVec2 a = pos + ImVec2(std::min(std::max(vx0, 0.0f), w - 3), 0);
+    ImVec2 b = pos + ImVec2(std::max(std::min(vx1, w), a.x - pos.x + 3), H_OVERVIEW - 1);
+    dl->AddRectFilled(a, b, ImColor(0,0,0,40));
+    dl->AddRect(a, b, fg);
+
+    ImVec2 mouse = ImGui::GetMousePos();
+    if (active && ImGui::IsWindowHovered() && ImGui::IsMouseClicked(0) &&
+        ImGui::IsMouseHoveringRect(pos, pos + ImVec2(w, H_OVERVIEW))) {
+        float x = mouse.x - pos.x;
+        overview_drag = &v;
+        overview_grab = ((x >= a.x - pos.x) && (x < b.x - pos.x)) ? (x - vx0) : ((vx1 - vx0) / 2);
+    }
+    if (overview_drag == &v) {
+        if (ImGui::IsMouseDown(0)) {
+            tpos = ov.t0 - v.offset + (mouse.x - pos.x - overview_grab) * tscale;
+        } else {
+            overview_drag = nullptr;
+        }
+    }
+}
+
+void TraceView(TraceState& v, ImVec2 origin, ImVec2 content, bool active) {
+    Trace& trace = *v.trace;
+    Group* groups = trace.get_groups();
+    auto red = ImColor(255,0,0);
+    auto fg = ImColor(0,0,0);
+    auto grid = ImColor(100,100,100);
+    auto counter_color = ImColor(60,120,200);
+    auto counter_peak_color = ImColor(170,200,240);
+    auto dl = ImGui::GetWindowDrawList();
+    ImGuiIO& io = ImGui::GetIO();
+    ImVec2 mouse = ImGui::GetMousePos();
+
+    // tscale: nanoseconds per horizontal pixel
+    // tdiv: divisor for nanoseconds to units
+    // tsedge: this trace's time at the left edge, tsfirst the ns it falls in
+    double tscale = frame_tscale;
+    int64_t tdiv;
+    const char* tunit;
+    int64_t tsegment = RulerSegment(tscale, &tdiv, &tunit);
+    float tick = tsegment / tscale / 5;
+    double tsedge = frame_tsedge + v.offset;
+    int64_t tsfirst = (int64_t) floor(tsedge);
+
+    // nothing of this trace may spill into another's view
+    ImGui::PushClipRect(origin, origin + content, true);
+
+    // the overview strip sits above the ruler
+    OverviewStrip(v, origin, content, active);
+    origin.y += H_OVERVIEW;
+    content.y -= H_OVERVIEW;
+
     // round down to prev segment
-    int64_t ts = (tsedge / tsegment) * tsegment;
+    int64_t ts = (tsfirst / tsegment) * tsegment;
 
     // figure the adjustment to start of drawing in pixels
     float adj = (tsedge - ts) / tscale;
@@ -353,35 +847,61 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
     // Draw Ruler and Grid
     ImVec2 pos = origin + ImVec2(W_NAMES, 0);
     ImVec2 size = content - ImVec2(W_NAMES, 0);
+    int64_t tslast = (int64_t) ceil(tsedge + size.x * tscale);
+    view_t0 = tsfirst - v.offset;
+    view_t1 = tslast - v.offset;
+
+    // read ahead of paged tracks in the direction the view moves
+    if (trace.pager != nullptr) {
+        int64_t span = tslast - tsfirst;
+        if (tsfirst > v.prev_view_t0) {
+            trace.pager->prefetch(tslast, tslast + span);
+        } else if (tsfirst < v.prev_view_t0) {
+            trace.pager->prefetch(tsfirst - span, tsfirst);
+        }
+        v.prev_view_t0 = tsfirst;
+    }
 
     if (mark0_pos != mark1_pos) {
-        int64_t n = mark0_pos - mark1_pos;
-        char tmp[64];
-        if (n < 0) {
-            n = -n;
-        }
-        if (n > 1000000000L) {
-            sprintf(tmp, "[mark] %ld.%06ld s", n / 1000000000L, (n % 1000000000L) / 1000L);
-        } else if (n > 1000000) {
-            sprintf(tmp, "[mark] %ld.%06ld ms", n / 1000000L, n % 1000000L);
-        } else if (n > 1000) {
-            sprintf(tmp, "[mark] %ld.%03ld us", n / 1000L, n % 1000L);
-        } else {
-            sprintf(tmp, "[mark] %ld ns", n);
+        int64_t k = mark0_pos - mark1_pos;
+        ImVec2 at(10, origin.y + 3);
+        if (!v.mark_text.replay(dl, cache_key(&k, 1), at)) {
+            char tmp[64];
+            char dur[48];
+            sprintf(tmp, "[mark] %s", fmt_duration(dur, k));
+            dl->AddText(at, red, tmp);
+            v.mark_text.end(dl);
         }
-        dl->AddText(ImVec2(10, origin.y + 3), red, tmp);
     }
     if (size.x < 0) {
+        ImGui::PopClipRect();
         return;
     }
-    ImGui::PushClipRect(pos, pos + size, false);
+    ImGui::PushClipRect(pos, pos + size, true);
     dl->AddRect(pos, pos + size, fg);
     dl->AddLine(pos + ImVec2(0, H_RULER), pos + ImVec2(size.x, H_RULER), fg);
+
+    // the labels only move within a segment, so are laid out again just
+    // when the zoom, the first segment or the width changes (with one
+    // label to spare, as panning brings it in from the right). AddText()
+    // would drop the glyphs past the ruler's edge, so they are placed one
+    // by one, under the ruler's own clip rect as on every replay
+    int64_t ruler[3] = { 0, ts, (int64_t) size.x };
+    memcpy(&ruler[0], &tscale, sizeof(tscale));
+    ImVec2 at = pos - ImVec2(adj, 0);
+    if (!v.ruler_text.replay(dl, cache_key(ruler, 3), at)) {
+        float w = tick * 5;
+        int64_t label = ts;
+        for (float x = 0; x < (size.x + w); x += w) {
+            char tmp[64];
+            sprintf(tmp, "%ld%s", label / tdiv, tunit);
+            batch.text(ImGui::GetFont(), at + ImVec2(x + 3, 0), fg, tmp);
+            label += tsegment;
+        }
+        batch.flush(dl);
+        v.ruler_text.end(dl);
+    }
     for (float x = 0 - adj; x < size.x; ) {
-        char tmp[64];
-        sprintf(tmp, "%ld%s", ts / tdiv, tunit);
-        dl->AddText(pos + ImVec2(x + 3, 0), fg, tmp);
-        ts += tsegment;
         dl->AddLine(pos + ImVec2(x, H_TICK), pos + ImVec2(x, size.y), grid);
         dl->AddLine(pos + ImVec2(x, 0),      pos + ImVec2(x, H_TICK), fg); x += tick;
         dl->AddLine(pos + ImVec2(x, Y_TICK), pos + ImVec2(x, H_TICK), fg); x += tick;
@@ -391,19 +911,42 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
     }
     ImGui::PopClipRect();
 
-    // Draw Group Names and Bars
+    // Draw Counter Tracks as min/max area graphs
+    float h_top = H_RULER;
+    if (show_counters) {
+        for (auto& c : trace.counters) {
+            pos = origin + ImVec2(W_NAMES, h_top);
+            unsigned level = c.level_for((int64_t) tscale);
+            float scale = (c.vmax > 0) ? ((H_COUNTER - 3) / c.vmax) : 0;
+            float bottom = pos.y + H_COUNTER - 2;
+            for (float x = 0; x < size.x; x += 1) {
+                int64_t t0 = (int64_t) floor(tsedge + x * tscale);
+                int64_t t1 = std::max(t0 + 1, (int64_t) floor(tsedge + (x + 1) * tscale));
+                float lo, hi;
+                if (!c.range(level, t0, t1, &lo, &hi)) {
+                    continue;
+                }
+                // light for the peak, dark for what was sustained
+                dl->AddLine(ImVec2(pos.x + x, bottom - hi * scale), ImVec2(pos.x + x, bottom),
+                            counter_peak_color);
+                if (lo > 0) {
+                    dl->AddLine(ImVec2(pos.x + x, bottom - lo * scale), ImVec2(pos.x + x, bottom),
+                                counter_color);
+                }
+            }
+            h_top += H_COUNTER;
+        }
+    }
+
+    // Lay out groups and tracks, taking fold and select clicks
     // record y position of tracks
-    pos = origin + ImVec2(0, H_RULER);
-    size = content;
+    int64_t names[8] = { (int64_t) origin.x, (int64_t) origin.y, (int64_t) content.x,
+                         (int64_t) content.y, (int64_t) h_top, (int64_t) show_counters,
+                         0, 0 }; // selected track and fold state, below
+    pos = origin + ImVec2(0, h_top);
+    v.track_layout.clear();
     for (Group* g = groups; g != NULL; g = g->next) {
-        dl->AddLine(pos, pos + ImVec2(size.x - 1, 1), ImColor(220,220,220));
-        dl->AddRectFilled(pos + ImVec2(0, 1),  pos + ImVec2(size.x - 1, H_GROUP - 2),
-                          ImColor(180,180,180));
-        dl->AddRectFilled(pos + ImVec2(0, H_GROUP - 2), pos + ImVec2(size.x - 1, H_GROUP - 2),
-                          ImColor(150,150,150));
-        dl->AddText(pos + ImVec2(H_GROUP, 0), fg, g->name, NULL);
-
-        if (do_collapse_change) {
+        if (frame_collapse) {
             g->flags &= ~GRP_FOLDED;
             g->flags |= (is_collapsed) ? GRP_FOLDED : 0;
         }
@@ -414,53 +957,96 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
             }
         }
 
-        if (g->flags & GRP_FOLDED) {
-            DrawRightTriangle(dl, pos + ImVec2(5, 4), ImVec2(11, 11), fg);
-        } else {
-            DrawDownTriangle(dl, pos + ImVec2(5, 4), ImVec2(11, 11), fg);
-        }
+        pos += ImVec2(0, H_GROUP);
         if (g->flags & GRP_FOLDED) {
             for (Track* t = g->first; t != NULL; t = t->next) {
-                t->y = pos.y;
+                t->y = pos.y - H_GROUP;
             }
-            pos += ImVec2(0, H_GROUP);
         } else {
-            pos += ImVec2(0, H_GROUP);
             for (Track* t = g->first; t != NULL; t = t->next) {
                 t->y = pos.y;
+                v.track_layout.push_back(t);
+                ImVec2 name = ImVec2(origin.x + 5, pos.y);
+                if (ImGui::IsMouseHoveringRect(name, name + ImVec2(W_NAMES, H_TRACE)) &&
+                    ImGui::IsMouseClicked(0)) {
+                    v.sel_track = (v.sel_track == t) ? nullptr : t;
+                }
                 pos += ImVec2(0, H_TRACE);
             }
         }
+        names[7] = (names[7] * 31) + (g->flags & GRP_FOLDED) + 1;
+    }
+    names[6] = (int64_t) (uintptr_t) v.sel_track;
+    uint64_t names_key = cache_key(names, 8);
+
+    // Draw Counter Labels, Group Names and Bars, laid out again only
+    // when folding, selection or the view's place or size changes
+    if (!v.groups_drawn.replay(dl, names_key, origin)) {
+        pos = origin + ImVec2(0, H_RULER);
+        if (show_counters) {
+            for (auto& c : trace.counters) {
+                char tmp[64];
+                snprintf(tmp, sizeof(tmp), "%s (max %.0f)", c.name, c.vmax);
+                dl->AddText(pos + ImVec2(5, 0), fg, tmp);
+                dl->AddLine(pos + ImVec2(0, H_COUNTER - 1), pos + ImVec2(content.x - 1, H_COUNTER - 1),
+                            ImColor(220,220,220));
+                pos += ImVec2(0, H_COUNTER);
+            }
+        }
+        size = content;
+        for (Group* g = groups; g != NULL; g = g->next) {
+            dl->AddLine(pos, pos + ImVec2(size.x - 1, 1), ImColor(220,220,220));
+            dl->AddRectFilled(pos + ImVec2(0, 1),  pos + ImVec2(size.x - 1, H_GROUP - 2),
+                              ImColor(180,180,180));
+            dl->AddRectFilled(pos + ImVec2(0, H_GROUP - 2), pos + ImVec2(size.x - 1, H_GROUP - 2),
+                              ImColor(150,150,150));
+            dl->AddText(pos + ImVec2(H_GROUP, 0), fg, g->name, NULL);
+
+            if (g->flags & GRP_FOLDED) {
+                DrawRightTriangle(dl, pos + ImVec2(5, 4), ImVec2(11, 11), fg);
+            } else {
+                DrawDownTriangle(dl, pos + ImVec2(5, 4), ImVec2(11, 11), fg);
+            }
+            pos += ImVec2(0, H_GROUP);
+            if (!(g->flags & GRP_FOLDED)) {
+                for (Track* t = g->first; t != NULL; t = t->next) {
+                    pos += ImVec2(0, H_TRACE);
+                }
+            }
+        }
+        v.groups_drawn.end(dl);
     }
 
     // Draw Track Names
-    pos = origin + ImVec2(5, H_RULER);
+    pos = origin + ImVec2(5, h_top);
     size = content;
-    ImGui::PushClipRect(pos, pos + ImVec2(W_NAMES, size.y), false);
-    for (Group* g = groups; g != NULL; g = g->next) {
-        pos += ImVec2(0, H_GROUP);
-        if (g->flags & GRP_FOLDED) {
-            continue;
-        }
-        for (Track* t = g->first; t != NULL; t = t->next) {
-            dl->AddText(pos, fg, t->name, NULL);
-            pos += ImVec2(0, H_TRACE);
+    ImGui::PushClipRect(pos, pos + ImVec2(W_NAMES, size.y), true);
+    if (!v.names_drawn.replay(dl, names_key, origin)) {
+        for (Group* g = groups; g != NULL; g = g->next) {
+            pos += ImVec2(0, H_GROUP);
+            if (g->flags & GRP_FOLDED) {
+                continue;
+            }
+            for (Track* t = g->first; t != NULL; t = t->next) {
+                dl->AddText(pos, (t == v.sel_track) ? red : fg, t->name, NULL);
+                pos += ImVec2(0, H_TRACE);
+            }
         }
+        v.names_drawn.end(dl);
     }
     ImGui::PopClipRect();
 
-    int64_t snap_ts = 0;
-    float snap_dist = 10000000.0;
-
     char cpu[5];
     cpu[0] = 'c';
     cpu[1] = 'p';
     cpu[2] = 'u';
     cpu[3] = '0';
     cpu[4] = 0;
-    pos = origin + ImVec2(W_NAMES, H_RULER);
+    static std::vector<std::pair<float,uint8_t>> cpu_labels;
+#define GPU_TASKS_PER_PX 16
+    pos = origin + ImVec2(W_NAMES, h_top);
     size = content - ImVec2(W_NAMES, 0);
-    ImGui::PushClipRect(pos + ImVec2(1,0), pos + size - ImVec2(1,0), false);
+    ImGui::PushClipRect(pos + ImVec2(1,0), pos + size - ImVec2(1,0), true);
     for (Group* g = groups; g != NULL; g = g->next) {
         pos += ImVec2(0, H_GROUP);
         if (g->flags & GRP_FOLDED) {
@@ -472,12 +1058,70 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
 
             // find the event before the left edge
             ++task;
-            task = std::lower_bound(task, end, tsedge);
+            task = std::lower_bound(task, end, tsfirst);
             --task;
 
-            ts = tsedge;
-            int64_t tsend = tsedge + ((int64_t)size.x) * tscale;
+            int64_t tsend = (int64_t) ceil(tsedge + size.x * tscale);
             int64_t last_x = 0xFFFFFFFFFFFFFFFFUL;
+            cpu_labels.clear();
+            uint64_t first = task - t->task.begin();
+            uint64_t last = std::lower_bound(task, end, tsend) - t->task.begin();
+            uint64_t px = (uint64_t) size.x;
+
+            // Tracks with far more intervals in view than pixels are
+            // drawn here, where same-color runs merge into few quads.
+            // Paged tracks too, as the GPU would need all of it.
+            if ((track_renderer != nullptr) && (trace.pager == nullptr)) {
+                if (((last - first) <= (px * GPU_TASKS_PER_PX)) &&
+                    track_renderer->draw(dl, t, first, last, pos.x, pos.y, pos.x + size.x,
+                                         pos.y + H_TRACE - 2, tsedge, tscale, task_state_color)) {
+                    // the loop below then only finds cpu labels, which
+                    // are worth the walk only when intervals are wide
+                    if ((last - first) > px) {
+                        task = end;
+                    }
+                    last_x = 0x7FFFFFFFFFFFFFFFL;
+                }
+            }
+
+            // Past that, the coarsest summary level whose buckets fit in
+            // a pixel stands in for the intervals, so a track costs a few
+            // runs per pixel however far out the view is.
+            int level = trace.task_lod.level_for(t->idx, tscale);
+            if ((task != end) && ((last - first) > px) && (level >= 0)) {
+                const std::vector<TaskState>& runs = trace.task_lod.levels[t->idx][level].runs;
+                auto run = std::upper_bound(runs.begin(), runs.end(), tsfirst,
+                                            [](int64_t ts, const TaskState& s) { return ts < s.ts; });
+                if (run != runs.begin()) {
+                    --run;
+                }
+                for (; ((run + 1) < runs.end()) && (run->ts < tsend); ++run) {
+                    float x0 = std::max(0.0, floor((run->ts - tsedge) / tscale));
+                    float x1 = std::min((double) size.x, floor(((run + 1)->ts - tsedge) / tscale));
+                    if (x1 > last_x) {
+                        batch.rect(pos.x + x0, pos.y, pos.x + x1, pos.y + H_TRACE - 2,
+                                   task_state_color[run->state]);
+                        last_x = x1;
+                    }
+                    if ((run->state != TS_RUNNING) || ((x1 - x0) <= 50)) {
+                        continue;
+                    }
+                    // label the interval the run starts with, if it is
+                    // wide enough to be labelled drawn as it is
+                    auto it = std::upper_bound(t->task.begin(), end, std::max(run->ts, tsfirst),
+                                               [](int64_t ts, const TaskState& s) { return ts < s.ts; });
+                    if ((it == t->task.begin()) || (it == end)) {
+                        continue;
+                    }
+                    int64_t ts0 = (it - 1)->ts;
+                    float lx0 = std::max(0.0, floor((ts0 - tsedge) / tscale));
+                    float lx1 = std::min((double) size.x, floor((it->ts - tsedge) / tscale));
+                    if (((it - 1)->state == TS_RUNNING) && ((lx1 - lx0) > 50)) {
+                        cpu_labels.push_back(std::make_pair(lx0, (it - 1)->cpu));
+                    }
+                }
+                task = end;
+            }
 
             while ((task != end) && (task->ts < tsend)) {
                 int64_t ts0 = task->ts;
@@ -488,34 +1132,23 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
                     break;
                 }
                 int64_t ts1 = task->ts;
-                if (ts0 < tsedge) {
-                    ts0 = tsedge;
-                }
-                if (ts1 > tsend) {
-                    ts1 = tsend;
-                }
 
                 // convert to local coords
-                float x0 = (ts0 - tsedge) / tscale;
-                float x1 = (ts1 - tsedge) / tscale;
-
-                if (is_marking) {
-                    float dist = fabs((mouse.x - pos.x) - x0);
-                    if (dist < snap_dist) {
-                        snap_dist = dist;
-                        snap_ts = ts0;
-                    }
-                }
+                float x0 = std::max(0.0, floor((ts0 - tsedge) / tscale));
+                float x1 = std::min((double) size.x, floor((ts1 - tsedge) / tscale));
 
                 if (x1 > last_x) {
-                    auto color = task_state_color[state];
-                    dl->AddRectFilled(pos + ImVec2(x0, 0), pos + ImVec2(x1, H_TRACE - 2), color);
-                    if ((state == TS_RUNNING) && ((x1 - x0) > 50)) {
-                        cpu[3] = '0' + cpuid;
-                        dl->AddText(pos + ImVec2(x0 + 10, -2.0), fg, cpu);
-                    }
+                    batch.rect(pos.x + x0, pos.y, pos.x + x1, pos.y + H_TRACE - 2, task_state_color[state]);
                     last_x = x1;
                 }
+                if ((state == TS_RUNNING) && ((x1 - x0) > 50)) {
+                    cpu_labels.push_back(std::make_pair(x0, cpuid));
+                }
+            }
+            batch.flush(dl);
+            for (auto& label : cpu_labels) {
+                cpu[3] = '0' + label.second;
+                dl->AddText(pos + ImVec2(label.first + 10, -2.0), fg, cpu);
             }
             pos += ImVec2(0, H_TRACE);
         }
@@ -536,9 +1169,7 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
     const ImFont::Glyph* gRECV = symbols->FindGlyph('J');
 #endif
 
-    Event* tt_evt;
-    float tt_dist = 1000000000.0;
-    pos = origin + ImVec2(W_NAMES, H_RULER);
+    pos = origin + ImVec2(W_NAMES, h_top);
     size = content - ImVec2(W_NAMES, 0);
     for (Group* g = groups; g != NULL; g = g->next) {
         pos += ImVec2(0, H_GROUP);
@@ -547,13 +1178,19 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
         }
         for (Track* t = g->first; t != NULL; t = t->next) {
             auto end = t->event.end();
-            auto start = std::lower_bound(t->event.begin(), end, tsedge);
-            int64_t tsend = tsedge + ((int64_t)size.x) * tscale;
+            auto start = std::lower_bound(t->event.begin(), end, tsfirst);
+            int64_t tsend = (int64_t) ceil(tsedge + size.x * tscale);
+
+            // Draw paired probe spans under all the events.
+            if (show_probes) {
+                DrawProbeSpans(dl, trace, t, pos, tsedge, tsend, tscale);
+            }
 
             // Draw system events first.
-            if (show_evts || show_interrupts || show_syscalls) {
+            if (show_evts || show_interrupts || show_syscalls || sel_waitq) {
                 for (auto e = start; (e != end) && (e->ts < tsend); ++e) {
-                    bool show = show_evts;
+                    if ((e->tag >= EVT_PROBE) || !EventShown(*e)) continue;
+                    ImU32 color = ImColor(0, 0, 220);
                     const ImFont::Glyph* glyph;
                     switch (e->tag) {
                     case EVT_PORT_WAIT:
@@ -575,50 +1212,36 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
                         break;
                     case EVT_SYSCALL_ENTER:
                         glyph = gUP;
-                        show = show_syscalls;
                         break;
                     case EVT_SYSCALL_EXIT:
                         glyph = gDOWN;
-                        show = show_syscalls;
                         break;
                     case EVT_IRQ_ENTER:
                         glyph = gDIAMOND;
-                        show = show_interrupts;
                         break;
                     case EVT_IRQ_EXIT:
                         glyph = gDIAMOND;
-                        show = show_interrupts;
                         break;
                     case EVT_PAGE_FAULT:
                         glyph = gDIAMOND;
-                        show = show_interrupts;
                         break;
                     case EVT_PAGE_FAULT_EXIT:
                         glyph = gDIAMOND;
-                        show = show_interrupts;
                         break;
                     case EVT_KWAIT_BLOCK:
-                        glyph = gDIAMOND;
-                        break;
                     case EVT_KWAIT_UNBLOCK:
-                        glyph = gDIAMOND;
-                        break;
                     case EVT_KWAIT_WAKE:
                         glyph = gDIAMOND;
+                        if (sel_waitq && (kwait_addr(*e) == sel_waitq)) {
+                            color = red;
+                        }
                         break;
                     default:
-                        show = false;
-                        break;
+                        continue;
                     }
-                    if (!show) continue;
 
                     auto gpos = pos + ImVec2((e->ts - tsedge) / (float)tscale, -1.0);
-                    float d = distish(gpos + ImVec2(8.0, 8.0), mouse);
-                    if (d < tt_dist) {
-                        tt_dist = d;
-                        tt_evt = &(*e);
-                    }
-                    symbols->RenderGlyph(dl, gpos, ImColor(0, 0, 220), glyph);
+                    batch.glyph(symbols, gpos, color, glyph);
                 }
             }
 
@@ -628,14 +1251,10 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
                     if (e->tag < EVT_PROBE) continue;
 
                     auto gpos = pos + ImVec2((e->ts - tsedge) / (float)tscale, -1.0);
-                    float d = distish(gpos + ImVec2(8.0, 8.0), mouse);
-                    if (d < tt_dist) {
-                        tt_dist = d;
-                        tt_evt = &(*e);
-                    }
-                    symbols->RenderGlyph(dl, gpos, colorify(e->tag), gDIAMOND);
+                    batch.glyph(symbols, gpos, colorify(e->tag), gDIAMOND);
                 }
             }
+            batch.flush(dl);
 
             // Draw flow events last since they cover other things.
             if (show_flow) {
@@ -662,28 +1281,891 @@ void TraceView(tv::Trace &trace, ImVec2 origin, ImVec2 content) {
         }
     }
 
-    if (sqrtf(tt_dist) < 12.0) {
+    // hit-test only the track under the cursor
+    pos = origin + ImVec2(W_NAMES, h_top);
+    Event* tt_evt = nullptr;
+    uint32_t tt_idx = 0;
+    Track* tt_track = nullptr;
+    if (active && (mouse.x >= pos.x) && (mouse.x < (pos.x + size.x))) {
+        tt_track = TrackAt(v, mouse.y);
+    }
+    if (tt_track != nullptr) {
+        tt_evt = EventAt(tt_track, mouse.x - pos.x, tsedge, tscale, &tt_idx);
+    }
+    bool hovering = false;
+    if (tt_evt != nullptr) {
+        auto center = ImVec2(pos.x + (tt_evt->ts - tsedge) / (float)tscale + 8.0, tt_track->y + 7.0);
+        hovering = sqrtf(distish(center, mouse)) < HIT_RADIUS;
+    }
+    if (hovering) {
         EventTooltip(trace, tt_evt);
+    } else if (show_probes && (tt_track != nullptr)) {
+        ProbeSpanTooltip(trace, tt_track, mouse.y - tt_track->y,
+                         (int64_t) (tsedge + (mouse.x - pos.x) * tscale));
+    }
+
+    // N/B and K below follow the per-event indexes; on a paged trace
+    // they show why they do nothing instead
+    bool indexed = (trace.pager == nullptr);
+    if (!indexed && active &&
+        (ViewKeyPressed(KEY(N)) || ViewKeyPressed(KEY(B)) || ViewKeyPressed(KEY(K), false))) {
+        not_indexed_notice = NOTICE_SECONDS;
+    }
+    if (active && (not_indexed_notice > 0)) {
+        ImGui::SetTooltip("%s", not_indexed_text);
+        not_indexed_notice -= io.DeltaTime;
+    }
+
+    // N/B: next/previous event like the hovered (or last found) one,
+    // on the same track, or on any track with shift held
+    int nav_dir = 0;
+    if (indexed && active && ViewKeyPressed(KEY(N))) {
+        nav_dir = 1;
+    }
+    if (indexed && active && ViewKeyPressed(KEY(B))) {
+        nav_dir = -1;
+    }
+    if (nav_dir) {
+        tv::EventRef from = v.nav_ref;
+        if (hovering) {
+            from.trackidx = tt_track->idx;
+            from.eventidx = tt_idx;
+        }
+        if ((hovering || v.nav_valid) && trace.find_adjacent(from, nav_dir, io.KeyShift, v.nav_ref)) {
+            v.nav_valid = true;
+            tpos = trace.get_event(v.nav_ref)->ts - v.offset - (view_t1 - view_t0) / 2;
+        }
+    }
+
+    // R: mark the next (shift: previous) TS_READY run on the selected
+    // track that is at least READY_MIN_PX wide at the current zoom
+#define READY_MIN_PX 20
+    if (active && ViewKeyPressed(KEY(R), false)) {
+        Track* t = v.sel_track;
+        if ((t == nullptr) && v.nav_valid) {
+            t = trace.get_track(v.nav_ref.trackidx);
+        }
+        int64_t from = ((mark0_pos != mark1_pos) ? mark0_pos : (view_t0 + view_t1) / 2) + v.offset;
+        int64_t start, end;
+        if ((t != nullptr) &&
+            trace.find_ready_run(t, from, io.KeyShift ? -1 : 1, (int64_t) (READY_MIN_PX * tscale), start, end)) {
+            mark0_pos = start - v.offset;
+            mark1_pos = end - v.offset;
+            tpos = mark0_pos - (view_t1 - view_t0) / 2;
+        }
+    }
+
+    // K: critical path back from the hovered (or last found) event
+    if (indexed && active && ViewKeyPressed(KEY(K), false)) {
+        if (hovering) {
+            tv::EventRef from;
+            from.trackidx = tt_track->idx;
+            from.eventidx = tt_idx;
+            v.crit.start(trace, from);
+            show_critpath_window = true;
+        } else if (v.nav_valid) {
+            v.crit.start(trace, v.nav_ref);
+            show_critpath_window = true;
+        }
+    }
+#define CRIT_HOPS_PER_FRAME 8
+    for (unsigned n = 0; (n < CRIT_HOPS_PER_FRAME) && v.crit.step(trace); n++) {
+    }
+
+    // highlight each hop and link it to the hop it woke
+    auto crit_color = ImColor(255,140,0);
+    for (size_t n = 0; n < v.crit.hops.size(); n++) {
+        const tv::CriticalHop& hop = v.crit.hops[n];
+        Track* t = trace.get_track(hop.trackidx);
+        if ((t->group != nullptr) && (t->group->flags & GRP_FOLDED)) {
+            continue;
+        }
+        float x0 = origin.x + W_NAMES + (hop.t0 - tsedge) / (float)tscale;
+        float x1 = origin.x + W_NAMES + (hop.t1 - tsedge) / (float)tscale;
+        dl->AddRect(ImVec2(x0, t->y), ImVec2(std::max(x1, x0 + 2), t->y + H_TRACE - 2), crit_color, 0.0, ~0, 2.0);
+        if ((n + 1) < v.crit.hops.size()) {
+            const tv::CriticalHop& prev = v.crit.hops[n + 1];
+            Track* pt = trace.get_track(prev.trackidx);
+            int64_t ts = hop.cause.eventidx ? trace.get_event(hop.cause)->ts : hop.t0;
+            auto p0 = ImVec2(origin.x + W_NAMES + (prev.t1 - tsedge) / (float)tscale, pt->y + 7.0);
+            auto p1 = ImVec2(origin.x + W_NAMES + (ts - tsedge) / (float)tscale, t->y + 7.0);
+            dl->AddLine(p0, p1, crit_color, 2.0);
+        }
+    }
+
+    if (v.nav_valid) {
+        Track* t = trace.get_track(v.nav_ref.trackidx);
+        if ((t->group == nullptr) || !(t->group->flags & GRP_FOLDED)) {
+            float x = (trace.get_event(v.nav_ref)->ts - tsedge) / (float)tscale;
+            auto center = ImVec2(origin.x + W_NAMES + x + 8.0, t->y + 7.0);
+            dl->AddCircle(center, 10.0, red, 12, 2.0);
+        }
     }
 
     if ((mark0_pos != mark1_pos) || is_marking) {
-        if (snap_dist < 8.0) {
-            mark1_pos = snap_ts;
+        Track* t;
+        if (is_marking && active && ((t = TrackAt(v, mouse.y)) != nullptr)) {
+            int64_t dist;
+            int64_t snap_ts = TransitionNear(t, mark1_pos + v.offset, &dist);
+            if (dist < (int64_t)(SNAP_DIST * tscale)) {
+                mark1_pos = snap_ts - v.offset;
+            }
         }
         pos = origin + ImVec2(W_NAMES, H_RULER);
         size = content - ImVec2(W_NAMES, 0);
-        float x0 = (mark0_pos - tsedge) / tscale;
-        float x1 = (mark1_pos - tsedge) / tscale;
+        float x0 = (mark0_pos + v.offset - tsedge) / tscale;
+        float x1 = (mark1_pos + v.offset - tsedge) / tscale;
         dl->AddLine(ImVec2(pos.x + x0, pos.y), ImVec2(pos.x + x0, pos.y + size.y), red);
         dl->AddLine(ImVec2(pos.x + x1, pos.y), ImVec2(pos.x + x1, pos.y + size.y), red);
     }
     ImGui::PopClipRect();
+    ImGui::PopClipRect();
+}
+
+// The windows below read the per-event indexes, which paged native
+// files do without; they say so instead of showing nothing.
+static bool NotIndexed(Trace& trace) {
+    if (trace.pager == nullptr) {
+        return false;
+    }
+    ImGui::TextWrapped("%s", not_indexed_text);
+    ImGui::End();
+    return true;
+}
+
+void WaitQueueView(Trace& trace) {
+    const auto& queues = trace.waitqs.queues;
+    char tmp[64];
+    char dur[48];
+
+    ImGui::SetNextWindowSize(ImVec2(720, 480), ImGuiSetCond_FirstUseEver);
+    ImGui::Begin("Wait Queues", &show_waitq_window);
+    if (NotIndexed(trace)) {
+        return;
+    }
+    ImGui::Text("%u wait queues", (unsigned) queues.size());
+    if (sel_waitq) {
+        ImGui::SameLine();
+        if (ImGui::SmallButton("Clear Selection")) {
+            sel_waitq = 0;
+        }
+    }
+
+    ImGui::BeginChild("queues", ImVec2(0, 260), true);
+    ImGui::Columns(7, "waitqs");
+    ImGui::Text("Wait Queue"); ImGui::NextColumn();
+    ImGui::Text("Blocks"); ImGui::NextColumn();
+    ImGui::Text("Threads"); ImGui::NextColumn();
+    ImGui::Text("Blocked"); ImGui::NextColumn();
+    ImGui::Text("Max"); ImGui::NextColumn();
+    ImGui::Text("Wakes"); ImGui::NextColumn();
+    ImGui::Text("Mutex"); ImGui::NextColumn();
+    ImGui::Separator();
+    ImGuiListClipper clipper(queues.size(), ImGui::GetTextLineHeightWithSpacing());
+    for (int n = clipper.DisplayStart; n < clipper.DisplayEnd; n++) {
+        const auto& q = queues[n];
+        sprintf(tmp, "%016lx", q.addr);
+        if (ImGui::Selectable(tmp, q.addr == sel_waitq, ImGuiSelectableFlags_SpanAllColumns)) {
+            sel_waitq = (q.addr == sel_waitq) ? 0 : q.addr;
+        }
+        ImGui::NextColumn();
+        ImGui::Text("%u", q.blocks); ImGui::NextColumn();
+        ImGui::Text("%u", (unsigned) q.blockers.size()); ImGui::NextColumn();
+        ImGui::Text("%s", fmt_duration(dur, q.blocked_total)); ImGui::NextColumn();
+        ImGui::Text("%s", fmt_duration(dur, q.blocked_max)); ImGui::NextColumn();
+        ImGui::Text("%u", q.wakes); ImGui::NextColumn();
+        ImGui::Text("%u", q.mutex_wakes); ImGui::NextColumn();
+    }
+    clipper.End();
+    ImGui::Columns(1);
+    ImGui::EndChild();
+
+    const tv::WaitQueue* q = trace.waitqs.find(sel_waitq);
+    if (q != nullptr) {
+        ImGui::Columns(2, "waitq-detail");
+        ImGui::Text("Blocked Threads"); ImGui::NextColumn();
+        ImGui::Text("Woken By"); ImGui::NextColumn();
+        ImGui::Separator();
+        for (unsigned n = 0; n < q->blockers.size() || n < q->wakers.size(); n++) {
+            if (n < q->blockers.size()) {
+                const auto& b = q->blockers[n];
+                ImGui::Text("%s  x%u  %s", trace.get_track(b.trackidx)->name,
+                            b.count, fmt_duration(dur, b.time));
+            }
+            ImGui::NextColumn();
+            if (n < q->wakers.size()) {
+                const auto& w = q->wakers[n];
+                ImGui::Text("%s  x%u  (%u mutex)", trace.get_track(w.trackidx)->name,
+                            w.count, w.mutex);
+            }
+            ImGui::NextColumn();
+        }
+        ImGui::Columns(1);
+    }
+    ImGui::End();
+}
+
+static char qry_name[64];
+static char qry_thread[64];
+static char qry_process[64];
+static int qry_range = 0;
+static bool qry_use_a = false;
+static bool qry_use_b = false;
+static int qry_a = 0;
+static int qry_b = 0;
+static bool qry_valid = true;
+static double qry_msec = 0;
+static std::vector<tv::EventRef> qry_results;
+
+static void RunQuery(Trace& trace) {
+    tv::Query q;
+    qry_valid = true;
+    if (qry_name[0] && !trace.query_name(q, qry_name)) {
+        qry_valid = false;
+        qry_results.clear();
+        return;
+    }
+    if (qry_use_a) {
+        q.args |= QRY_ARG_A;
+        q.a = qry_a;
+    }
+    if (qry_use_b) {
+        q.args |= QRY_ARG_B;
+        q.b = qry_b;
+    }
+    if (qry_range == 1) {
+        q.t0 = view_t0;
+        q.t1 = view_t1;
+    } else if ((qry_range == 2) && (mark0_pos != mark1_pos)) {
+        q.t0 = std::min(mark0_pos, mark1_pos);
+        q.t1 = std::max(mark0_pos, mark1_pos);
+    }
+    if (qry_thread[0] || qry_process[0]) {
+        q.tracks.resize(trace.tracks.size());
+        for (Track* t : trace.tracks) {
+            bool match = true;
+            if (qry_thread[0] && !strstr(t->name, qry_thread)) {
+                match = false;
+            }
+            if (qry_process[0] && ((t->group == nullptr) || !strstr(t->group->name, qry_process))) {
+                match = false;
+            }
+            q.tracks[t->idx] = match;
+        }
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    trace.query(q, qry_results);
+    auto t1 = std::chrono::steady_clock::now();
+    qry_msec = std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+void QueryView(Trace& trace) {
+    static const char* ranges[] = { "Whole Trace", "Visible", "Mark" };
+    static int64_t last_t0 = 0;
+    static int64_t last_t1 = 0;
+    bool changed = false;
+    char tmp[256];
+
+    ImGui::SetNextWindowSize(ImVec2(560, 480), ImGuiSetCond_FirstUseEver);
+    ImGui::Begin("Query", &show_query_window);
+    if (NotIndexed(trace)) {
+        return;
+    }
+    changed |= ImGui::InputText("Event / Syscall / Probe", qry_name, sizeof(qry_name));
+    changed |= ImGui::InputText("Thread", qry_thread, sizeof(qry_thread));
+    changed |= ImGui::InputText("Process", qry_process, sizeof(qry_process));
+    changed |= ImGui::Checkbox("##use_a", &qry_use_a);
+    ImGui::SameLine();
+    changed |= ImGui::InputInt("Arg A", &qry_a);
+    changed |= ImGui::Checkbox("##use_b", &qry_use_b);
+    ImGui::SameLine();
+    changed |= ImGui::InputInt("Arg B", &qry_b);
+    changed |= ImGui::Combo("Range", &qry_range, ranges, 3);
+
+    // follow the view (or marks) when querying a moving range
+    int64_t t0 = (qry_range == 1) ? view_t0 : mark0_pos;
+    int64_t t1 = (qry_range == 1) ? view_t1 : mark1_pos;
+    if ((qry_range != 0) && ((t0 != last_t0) || (t1 != last_t1))) {
+        last_t0 = t0;
+        last_t1 = t1;
+        changed = true;
+    }
+    if (changed) {
+        RunQuery(trace);
+    }
+
+    if (!qry_valid) {
+        ImGui::Text("unknown event, syscall, or probe '%s'", qry_name);
+    } else {
+        ImGui::Text("%u results%s in %.3f ms", (unsigned) qry_results.size(),
+                    (qry_results.size() == tv::Query().limit) ? " (limit reached)" : "",
+                    qry_msec);
+    }
+    ImGui::Separator();
+
+    ImGui::BeginChild("results");
+    ImGuiListClipper clipper(qry_results.size(), ImGui::GetTextLineHeightWithSpacing());
+    for (int n = clipper.DisplayStart; n < clipper.DisplayEnd; n++) {
+        Event* evt = trace.get_event(qry_results[n]);
+        char dur[48];
+        char desc[192];
+        EventText(trace, evt, desc, sizeof(desc));
+        for (char* p = desc; *p; p++) {
+            if (*p == '\n') *p = ' ';
+        }
+        snprintf(tmp, sizeof(tmp), "%s  %s  %s", fmt_duration(dur, evt->ts),
+                 trace.get_track(qry_results[n].trackidx)->name, desc);
+        ImGui::PushID(n);
+        if (ImGui::Selectable(tmp)) {
+            // center the view on the event
+            tpos = evt->ts - (view_t1 - view_t0) / 2;
+        }
+        ImGui::PopID();
+    }
+    clipper.End();
+    ImGui::EndChild();
+    ImGui::End();
+}
+
+// columns of the residency table, in display order
+static const struct {
+    const char* name;
+    int state;
+} res_columns[] = {
+    { "Running", TS_RUNNING },
+    { "Ready", TS_READY },
+    { "Blocked", TS_BLOCKED },
+    { "Sleeping", TS_SLEEPING },
+    { "Suspended", TS_SUSPENDED },
+};
+#define RES_COLUMNS (sizeof(res_columns) / sizeof(res_columns[0]))
+
+static int res_rows = 0;
+static int res_range = 0;
+static int res_sort = 1; // 0 is the name, 1.. the state columns
+static tv::ResidencyReport res_report;
+
+struct ResidencyRow {
+    const char* name;
+    const tv::Residency* r;
+};
+
+void ResidencyView(Trace& trace) {
+    static const char* rows[] = { "Threads", "Processes", "CPUs" };
+    static const char* ranges[] = { "Whole Trace", "Mark" };
+    static int64_t last_t0 = 1;
+    static int64_t last_t1 = 0;
+    char names[MAXCPU][16];
+    char dur[48];
+
+    ImGui::SetNextWindowSize(ImVec2(720, 480), ImGuiSetCond_FirstUseEver);
+    ImGui::Begin("Residency", &show_residency_window);
+    if (NotIndexed(trace)) {
+        return;
+    }
+    ImGui::Combo("Rows", &res_rows, rows, 3);
+    ImGui::Combo("Range", &res_range, ranges, 2);
+
+    int64_t t0 = -0x7FFFFFFFFFFFFFFFL;
+    int64_t t1 = 0x7FFFFFFFFFFFFFFFL;
+    if ((res_range == 1) && (mark0_pos != mark1_pos)) {
+        t0 = std::min(mark0_pos, mark1_pos);
+        t1 = std::max(mark0_pos, mark1_pos);
+    }
+    if ((t0 != last_t0) || (t1 != last_t1)) {
+        trace.residency.query(trace, t0, t1, res_report);
+        last_t0 = t0;
+        last_t1 = t1;
+    }
+    int64_t span = res_report.t1 - res_report.t0;
+    ImGui::Text("%s", fmt_duration(dur, span));
+
+    std::vector<ResidencyRow> list;
+    if (res_rows == 0) {
+        for (Track* t : trace.tracks) {
+            list.push_back({ t->name, &res_report.threads[t->idx] });
+        }
+    } else if (res_rows == 1) {
+        unsigned n = 0;
+        for (Group* g = trace.get_groups(); g != nullptr; g = g->next) {
+            list.push_back({ g->name, &res_report.groups[n++] });
+        }
+    } else {
+        for (unsigned n = 0; n < MAXCPU; n++) {
+            snprintf(names[n], sizeof(names[n]), "cpu %u", n);
+            list.push_back({ names[n], &res_report.cpus[n] });
+        }
+    }
+    if (res_sort == 0) {
+        std::sort(list.begin(), list.end(), [](const ResidencyRow& a, const ResidencyRow& b) {
+            return strcmp(a.name, b.name) < 0;
+        });
+    } else {
+        int state = res_columns[res_sort - 1].state;
+        std::stable_sort(list.begin(), list.end(), [state](const ResidencyRow& a, const ResidencyRow& b) {
+            return a.r->time[state] > b.r->time[state];
+        });
+    }
+
+    ImGui::BeginChild("residency");
+    ImGui::Columns(RES_COLUMNS + 2, "residency");
+    if (ImGui::Selectable("Name", res_sort == 0)) {
+        res_sort = 0;
+    }
+    ImGui::NextColumn();
+    for (unsigned n = 0; n < RES_COLUMNS; n++) {
+        if (ImGui::Selectable(res_columns[n].name, res_sort == (int) (n + 1))) {
+            res_sort = n + 1;
+        }
+        ImGui::NextColumn();
+    }
+    ImGui::Text("Running %%"); ImGui::NextColumn();
+    ImGui::Separator();
+    ImGuiListClipper clipper(list.size(), ImGui::GetTextLineHeightWithSpacing());
+    for (int n = clipper.DisplayStart; n < clipper.DisplayEnd; n++) {
+        const tv::Residency* r = list[n].r;
+        ImGui::Text("%s", list[n].name); ImGui::NextColumn();
+        for (unsigned c = 0; c < RES_COLUMNS; c++) {
+            ImGui::Text("%s", fmt_duration(dur, r->time[res_columns[c].state]));
+            ImGui::NextColumn();
+        }
+        ImGui::Text("%.1f", span ? (100.0 * r->time[TS_RUNNING] / span) : 0.0);
+        ImGui::NextColumn();
+    }
+    clipper.End();
+    ImGui::Columns(1);
+    ImGui::EndChild();
+    ImGui::End();
+}
+
+// rows of each list in the mark statistics
+#define MARK_TOP 8
+
+// live summary of the marked range, recomputed as the mark moves
+void MarkStatsView(Trace& trace) {
+    static tv::MarkStats stats;
+    static int64_t last_t0 = 1;
+    static int64_t last_t1 = 0;
+    char dur[48];
+
+    int64_t t0 = std::min(mark0_pos, mark1_pos);
+    int64_t t1 = std::max(mark0_pos, mark1_pos);
+
+    ImGui::SetNextWindowPos(ImVec2(10, 40), ImGuiSetCond_FirstUseEver);
+    ImGui::Begin("Mark", &show_mark_window, ImGuiWindowFlags_AlwaysAutoResize);
+    ImGui::Text("%s", fmt_duration(dur, t1 - t0));
+    if (NotIndexed(trace)) {
+        return;
+    }
+    if ((t0 != last_t0) || (t1 != last_t1)) {
+        trace.mark_stats(t0, t1, stats);
+        last_t0 = t0;
+        last_t1 = t1;
+    }
+    ImGui::Text("IPC: %u writes (%lu bytes), %u reads (%lu bytes)",
+                stats.ipc_writes, stats.ipc_write_bytes, stats.ipc_reads, stats.ipc_read_bytes);
+
+    ImGui::Separator();
+    ImGui::Columns(3, "mark");
+    ImGui::Text("Events"); ImGui::NextColumn();
+    ImGui::Text("Syscalls"); ImGui::NextColumn();
+    ImGui::Text("Running"); ImGui::NextColumn();
+    for (unsigned n = 0; n < MARK_TOP; n++) {
+        if (n < stats.tags.size()) {
+            uint32_t tag = stats.tags[n].first;
+            const char* name = (tag >= EVT_PROBE) ? trace.probe_name(tag) : evtname(tag);
+            ImGui::Text("%6u %s", stats.tags[n].second, name ? name : "probe");
+        }
+        ImGui::NextColumn();
+        if (n < stats.syscalls.size()) {
+            const char* name = trace.syscall_name(stats.syscalls[n].first);
+            if (name) {
+                ImGui::Text("%6u %s", stats.syscalls[n].second, name);
+            } else {
+                ImGui::Text("%6u sys_%u", stats.syscalls[n].second, stats.syscalls[n].first);
+            }
+        }
+        ImGui::NextColumn();
+        if (n < stats.running.size()) {
+            ImGui::Text("%s %s", fmt_duration(dur, stats.running[n].second),
+                        trace.get_track(stats.running[n].first)->name);
+        }
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+    ImGui::End();
+}
+
+// what the diff table shows, and the quantity within it
+static int diff_rows = 0;
+static int diff_value = 0;
+static int diff_sort = 3; // 0 name, 1 baseline, 2 candidate, 3 delta
+
+struct DiffLine {
+    const char* name;
+    bool has_a;
+    bool has_b;
+    int64_t a;
+    int64_t b;
+};
+
+static const char* fmt_diff_value(char* tmp, int64_t n, bool time, bool sign) {
+    char* p = tmp;
+    if (sign) {
+        *p++ = (n < 0) ? '-' : '+';
+    }
+    if (time) {
+        fmt_duration(p, n);
+    } else {
+        sprintf(p, "%ld", sign ? ((n < 0) ? -n : n) : n);
+    }
+    return tmp;
+}
+
+// baseline against candidate, by thread, syscall, or event name
+void DiffView(void) {
+    static const char* rows[] = { "Threads", "Syscalls", "Events" };
+    static const char* syscall_values[] = { "Mean Latency", "Max Latency", "Count" };
+    const tv::TraceDiff& d = trace_diff;
+    char tmp[64];
+
+    ImGui::SetNextWindowSize(ImVec2(720, 480), ImGuiSetCond_FirstUseEver);
+    ImGui::Begin("Diff", &show_diff_window);
+    ImGui::Text("baseline: %s", views[0].trace->source);
+    ImGui::Text("candidate: %s", views[1].trace->source);
+    if (ImGui::Combo("Rows", &diff_rows, rows, 3)) {
+        diff_value = 0;
+    }
+    bool time = true;
+    std::vector<DiffLine> list;
+    if (diff_rows == 0) {
+        const char* states[RES_COLUMNS];
+        for (unsigned n = 0; n < RES_COLUMNS; n++) {
+            states[n] = res_columns[n].name;
+        }
+        ImGui::Combo("State", &diff_value, states, RES_COLUMNS);
+        int state = res_columns[diff_value].state;
+        for (auto& t : d.threads) {
+            list.push_back({ t.name, t.a >= 0, t.b >= 0, t.time_a.time[state], t.time_b.time[state] });
+        }
+    } else if (diff_rows == 1) {
+        ImGui::Combo("Value", &diff_value, syscall_values, 3);
+        time = (diff_value != 2);
+        for (auto& sc : d.syscalls) {
+            DiffLine line = { sc.name, sc.count_a != 0, sc.count_b != 0, 0, 0 };
+            if (diff_value == 0) {
+                line.a = sc.mean_a;
+                line.b = sc.mean_b;
+            } else if (diff_value == 1) {
+                line.a = sc.max_a;
+                line.b = sc.max_b;
+            } else {
+                line.a = sc.count_a;
+                line.b = sc.count_b;
+            }
+            list.push_back(line);
+        }
+    } else {
+        time = false;
+        for (auto& e : d.events) {
+            list.push_back({ e.name, true, true, e.a, e.b });
+        }
+    }
+    std::stable_sort(list.begin(), list.end(), [](const DiffLine& x, const DiffLine& y) {
+        switch (diff_sort) {
+        case 0: return strcmp(x.name, y.name) < 0;
+        case 1: return x.a > y.a;
+        case 2: return x.b > y.b;
+        default: return std::abs(x.b - x.a) > std::abs(y.b - y.a);
+        }
+    });
+
+    static const char* headers[] = { "Name", "Baseline", "Candidate", "Delta" };
+    ImGui::BeginChild("diff");
+    ImGui::Columns(5, "diff");
+    for (int n = 0; n < 4; n++) {
+        if (ImGui::Selectable(headers[n], diff_sort == n)) {
+            diff_sort = n;
+        }
+        ImGui::NextColumn();
+    }
+    ImGui::Text("Delta %%"); ImGui::NextColumn();
+    ImGui::Separator();
+    ImGuiListClipper clipper(list.size(), ImGui::GetTextLineHeightWithSpacing());
+    for (int n = clipper.DisplayStart; n < clipper.DisplayEnd; n++) {
+        const DiffLine& line = list[n];
+        ImGui::Text("%s", line.name); ImGui::NextColumn();
+        ImGui::Text("%s", line.has_a ? fmt_diff_value(tmp, line.a, time, false) : "-");
+        ImGui::NextColumn();
+        ImGui::Text("%s", line.has_b ? fmt_diff_value(tmp, line.b, time, false) : "-");
+        ImGui::NextColumn();
+        ImGui::Text("%s", fmt_diff_value(tmp, line.b - line.a, time, true)); ImGui::NextColumn();
+        if (line.a) {
+            ImGui::Text("%+.1f", 100.0 * (line.b - line.a) / line.a);
+        }
+        ImGui::NextColumn();
+    }
+    clipper.End();
+    ImGui::Columns(1);
+    ImGui::EndChild();
+    ImGui::End();
+}
+
+static int probe_sel = -1;
+
+// counts and lengths of each begin/end probe pair, with a log2
+// histogram of the selected one
+void ProbesView(Trace& trace) {
+    char dur[48];
+    const std::vector<tv::ProbePair>& pairs = trace.probes.pairs;
+
+    ImGui::SetNextWindowSize(ImVec2(720, 400), ImGuiSetCond_FirstUseEver);
+    ImGui::Begin("Probes", &show_probes_window);
+    if (NotIndexed(trace)) {
+        return;
+    }
+    if (pairs.empty()) {
+        ImGui::Text("no paired probes (see -pair=)");
+        ImGui::End();
+        return;
+    }
+    if (probe_sel >= (int) pairs.size()) {
+        probe_sel = -1;
+    }
+    if (probe_sel >= 0) {
+        const tv::ProbePair& p = pairs[probe_sel];
+        float hist[PROBE_HIST_BUCKETS];
+        int first = PROBE_HIST_BUCKETS;
+        int last = 0;
+        for (int n = 0; n < PROBE_HIST_BUCKETS; n++) {
+            hist[n] = p.hist[n];
+            if (p.hist[n]) {
+                first = std::min(first, n);
+                last = n;
+            }
+        }
+        if (first <= last) {
+            char lo[48], hi[48], label[128];
+            snprintf(label, sizeof(label), "%s .. %s", fmt_duration(lo, 1L << first),
+                     fmt_duration(hi, 2L << last));
+            ImGui::PlotHistogram("##hist", hist + first, last - first + 1, 0, label,
+                                 0.0f, 3.4e38f, ImVec2(0, 80));
+        }
+        ImGui::Separator();
+    }
+    ImGui::Columns(6, "probes");
+    ImGui::Text("Probe"); ImGui::NextColumn();
+    ImGui::Text("Count"); ImGui::NextColumn();
+    ImGui::Text("Mean"); ImGui::NextColumn();
+    ImGui::Text("Min"); ImGui::NextColumn();
+    ImGui::Text("Max"); ImGui::NextColumn();
+    ImGui::Text("Unmatched"); ImGui::NextColumn();
+    ImGui::Separator();
+    for (size_t n = 0; n < pairs.size(); n++) {
+        const tv::ProbePair& p = pairs[n];
+        ImGui::PushID(n);
+        if (ImGui::Selectable(p.name, probe_sel == (int) n, ImGuiSelectableFlags_SpanAllColumns)) {
+            probe_sel = (probe_sel == (int) n) ? -1 : n;
+        }
+        ImGui::PopID();
+        ImGui::NextColumn();
+        ImGui::Text("%u", p.count); ImGui::NextColumn();
+        ImGui::Text("%s", fmt_duration(dur, p.count ? (p.total / p.count) : 0)); ImGui::NextColumn();
+        ImGui::Text("%s", fmt_duration(dur, p.min)); ImGui::NextColumn();
+        ImGui::Text("%s", fmt_duration(dur, p.max)); ImGui::NextColumn();
+        ImGui::Text("%u", p.unmatched); ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+    ImGui::End();
+}
+
+static const char* crit_edge_name(uint8_t edge) {
+    switch (edge) {
+    case CP_EDGE_IPC: return "channel";
+    case CP_EDGE_WAKE: return "kwait";
+    default: return "";
+    }
+}
+
+// the hops of each view's critical path, latest first
+void CriticalPathView(void) {
+    char dur[48];
+    char tmp[256];
+
+    ImGui::SetNextWindowSize(ImVec2(640, 300), ImGuiSetCond_FirstUseEver);
+    ImGui::Begin("Critical Path", &show_critpath_window);
+    for (size_t i = 0; i < views.size(); i++) {
+        TraceState& v = views[i];
+        if (v.crit.hops.empty()) {
+            continue;
+        }
+        if (views.size() > 1) {
+            ImGui::Text("%s", v.trace->source);
+        }
+        const tv::CriticalHop& last = v.crit.hops.back();
+        ImGui::Text("%u hops over %s%s", (unsigned) v.crit.hops.size(),
+                    fmt_duration(dur, v.crit.hops[0].t1 - last.t0),
+                    v.crit.done ? "" : " (searching)");
+        ImGui::Separator();
+        for (size_t n = 0; n < v.crit.hops.size(); n++) {
+            const tv::CriticalHop& hop = v.crit.hops[n];
+            char span[48];
+            snprintf(tmp, sizeof(tmp), "%s  %s  %s %s", fmt_duration(dur, hop.t0),
+                     fmt_duration(span, hop.t1 - hop.t0),
+                     v.trace->get_track(hop.trackidx)->name, crit_edge_name(hop.cause_edge));
+            ImGui::PushID((int) (i * CP_MAX_HOPS + n));
+            if (ImGui::Selectable(tmp)) {
+                // center the view on the hop
+                tpos = (hop.t0 + hop.t1) / 2 - v.offset - (view_t1 - view_t0) / 2;
+            }
+            ImGui::PopID();
+        }
+        ImGui::Separator();
+    }
+    ImGui::End();
+}
+
+// the loaded traces and what each costs in memory
+void SessionView(void) {
+    char dur[48];
+    size_t total = 0;
+
+    ImGui::SetNextWindowSize(ImVec2(720, 240), ImGuiSetCond_FirstUseEver);
+    ImGui::Begin("Session", &show_session_window);
+    ImGui::Columns(5, "session");
+    ImGui::Text("Trace"); ImGui::NextColumn();
+    ImGui::Text("Tracks"); ImGui::NextColumn();
+    ImGui::Text("Events"); ImGui::NextColumn();
+    ImGui::Text("Import"); ImGui::NextColumn();
+    ImGui::Text("Memory"); ImGui::NextColumn();
+    ImGui::Separator();
+    for (Trace* trace : session.traces) {
+        uint64_t events = 0;
+        for (Track* t : trace->tracks) {
+            events += t->event.size();
+        }
+        size_t bytes = trace->memory();
+        total += bytes;
+        ImGui::Text("%s", trace->source ? trace->source : "-"); ImGui::NextColumn();
+        ImGui::Text("%u", (unsigned) trace->tracks.size()); ImGui::NextColumn();
+        ImGui::Text("%lu", events); ImGui::NextColumn();
+        ImGui::Text("%s", fmt_duration(dur, trace->stats.import_ns)); ImGui::NextColumn();
+        ImGui::Text("%.1f MB", bytes / (1024.0 * 1024.0)); ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+    ImGui::Separator();
+    ImGui::Text("%.1f MB in all, names %.1f KB", total / (1024.0 * 1024.0),
+                session.names.bytes / 1024.0);
+    ImGui::End();
+}
+
+// batch operations that need no window, returns -1 if none was requested
+int traceviz_headless(int argc, char** argv) {
+    bool headless = false;
+    for (int n = 1; n < argc; n++) {
+        if (!strncmp(argv[n], "-export=", 8) || !strncmp(argv[n], "-text", 5)) {
+            headless = true;
+        }
+    }
+    if (!headless) {
+        return -1;
+    }
+    static Trace trace;
+    tv::ImportOptions& opt = trace.options;
+    int n = tv::parse_import_options(argc, argv, opt);
+    if ((n < 0) || (n != (argc - 1))) {
+        return 1;
+    }
+    // a text dump reads the records and nothing else
+    if (opt.text_path) {
+        return tv::dump_text(argv[n], opt) ? 1 : 0;
+    }
+    if (trace.import(argv[n])) {
+        return 1;
+    }
+    return tv::export_trace(trace, opt.export_path) ? 1 : 0;
+}
+
+static void ExportTo(const char* suffix) {
+    char path[1024];
+    if (MAIN_TRACE.source == nullptr) {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s%s", MAIN_TRACE.source, suffix);
+    if (tv::export_trace(MAIN_TRACE, path) == 0) {
+        fprintf(stderr, "exported '%s'\n", path);
+    }
+}
+
+// the earliest task state of a trace, after import has rebased it, or
+// 0 for an empty trace
+static int64_t TraceStart(const Trace& trace) {
+    return (trace.residency.tmin <= trace.residency.tmax) ? trace.residency.tmin : 0;
+}
+
+// a directory stands for the trace files in it, in name order, leaving
+// out what else is kept beside them (such as the File menu's exports)
+static void AddPath(const char* path, std::vector<const char*>& paths) {
+    struct stat st;
+    DIR* dir;
+    if ((stat(path, &st) < 0) || !S_ISDIR(st.st_mode) || ((dir = opendir(path)) == nullptr)) {
+        paths.push_back(path);
+        return;
+    }
+    std::vector<const char*> files;
+    struct dirent* de;
+    while ((de = readdir(dir)) != nullptr) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        char tmp[1024];
+        snprintf(tmp, sizeof(tmp), "%s/%s", path, de->d_name);
+        if ((stat(tmp, &st) == 0) && S_ISREG(st.st_mode) && tv::is_trace_file(tmp)) {
+            files.push_back(strdup(tmp));
+        }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end(), [](const char* a, const char* b) {
+        return strcmp(a, b) < 0;
+    });
+    paths.insert(paths.end(), files.begin(), files.end());
 }
 
 int traceviz_main(int argc, char** argv) {
-    TheTrace.import(argc, argv);
+    // every trace file (or directory of them) after the options is
+    // imported in parallel; those that fail are reported and left out
+    // before any view is built, and two that remain are compared as a
+    // baseline and a candidate
+    tv::ImportOptions opt;
+    memset(&opt, 0, sizeof(opt));
+    int n = tv::parse_import_options(argc, argv, opt);
+    std::vector<const char*> paths;
+    for (; (n > 0) && (n < argc); n++) {
+        AddPath(argv[n], paths);
+    }
+    session.import(paths, opt);
+    if (session.traces.empty()) {
+        session.traces.push_back(new Trace());
+    }
+    for (Trace* trace : session.traces) {
+        TraceState v;
+        v.trace = trace;
+        // line the traces up at their starts, which import has already
+        // moved to near 0 (first_timestamp is from before that)
+        v.offset = views.empty() ? 0 : (TraceStart(*trace) - TraceStart(*views[0].trace));
+        v.sel_track = nullptr;
+        v.nav_valid = false;
+        v.prev_view_t0 = 0;
+        views.push_back(v);
+    }
+    // the diff walks every event of both traces
+    if ((views.size() == 2) && (views[0].trace->pager == nullptr) &&
+        (views[1].trace->pager == nullptr)) {
+        diff_mode = true;
+        trace_diff.build(*views[0].trace, *views[1].trace);
+    }
 
-    tpos = TheTrace.first_timestamp;
+    tpos = TraceStart(MAIN_TRACE);
 
     for (unsigned n = 0; n < ImGuiKey_COUNT; n++) {
         keymap[n] = ImGui::GetKeyIndex(n);
@@ -737,6 +2219,18 @@ int traceviz_render(void) {
 
     auto io = ImGui::GetIO();
 
+    if (track_renderer != nullptr) {
+        track_renderer->frame();
+    }
+
+    // nothing from the last frame still points into paged tracks
+    tv::column_tick();
+    for (auto& v : views) {
+        if (v.trace->pager != nullptr) {
+            v.trace->pager->trim();
+        }
+    }
+
     // Render Trace Window
     auto bg = ImColor(255,255,255);
     ImGui::SetNextWindowSize(io.DisplaySize, ImGuiSetCond_Always);
@@ -754,7 +2248,14 @@ int traceviz_render(void) {
     auto origin = ImGui::GetWindowPos();
     auto size = ImGui::GetContentRegionAvail();
     auto pos = ImGui::GetCursorPos() + origin;
-    TraceView(TheTrace, pos, size);
+    ViewControls(pos, size);
+    size.y = (float) (int) (size.y / views.size());
+    auto mouse = ImGui::GetMousePos();
+    for (auto& v : views) {
+        bool active = (views.size() == 1) || ((mouse.y >= pos.y) && (mouse.y < (pos.y + size.y)));
+        TraceView(v, pos, size, active);
+        pos.y += size.y;
+    }
     ImGui::End();
     ImGui::PopStyleColor();
     ImGui::PopStyleVar();
@@ -765,12 +2266,22 @@ int traceviz_render(void) {
     ImGui::Begin("Trace");
     if (ImGui::BeginMainMenuBar()) {
         if (ImGui::BeginMenu("File")) {
+            if (ImGui::MenuItem("Export Chrome JSON")) { ExportTo(".json"); }
+            if (ImGui::MenuItem("Export Perfetto")) { ExportTo(".pftrace"); }
             ImGui::MenuItem("Quit", "ESC");
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("Window")) {
             if (ImGui::MenuItem("Color Editor")) { show_color_editor = true; }
             if (ImGui::MenuItem("Metrics")) { show_metrics_window = true; }
+            if (ImGui::MenuItem("Wait Queues")) { show_waitq_window = true; }
+            if (ImGui::MenuItem("Query")) { show_query_window = true; }
+            if (ImGui::MenuItem("Residency")) { show_residency_window = true; }
+            if (ImGui::MenuItem("Mark Statistics")) { show_mark_window = true; }
+            if (diff_mode && ImGui::MenuItem("Diff")) { show_diff_window = true; }
+            if (ImGui::MenuItem("Critical Path")) { show_critpath_window = true; }
+            if (ImGui::MenuItem("Probes")) { show_probes_window = true; }
+            if (ImGui::MenuItem("Session")) { show_session_window = true; }
             if (ImGui::MenuItem("Help")) { show_help_window = true; }
             ImGui::EndMenu();
         }
@@ -782,7 +2293,7 @@ int traceviz_render(void) {
     if (show_color_editor) {
         ImGui::Begin("Color Editor", &show_color_editor);
         for (unsigned n = 0; n <= TS_LAST; n++) {
-            if (ImGui::ColorEdit3(task_state_name[n], task_float_color + n * 3)) {
+            if (ImGui::ColorEdit3(tv::state_name(n), task_float_color + n * 3)) {
                 task_state_color[n] = ImColor(task_float_color[n*3+0],
                                               task_float_color[n*3+1],
                                               task_float_color[n*3+2]);
@@ -796,6 +2307,7 @@ int traceviz_render(void) {
         ImGui::Begin("Help", &show_help_window);
         ImGui::Text("A/D - Pan Left / Pan Right");
         ImGui::Text("W/S - Zoom In / Zoom Out");
+        ImGui::Text("Mouse Wheel - Zoom About The Cursor");
         ImGui::Text("Q - Collapse / Expand all");
         ImGui::Text(" ");
         ImGui::Text("E - Toggle Show Events");
@@ -803,15 +2315,60 @@ int traceviz_render(void) {
         ImGui::Text("I - Toggle Show Interrupts");
         ImGui::Text("C - Toggle Show Syscalls");
         ImGui::Text("P - Toggle Show Probes");
+        ImGui::Text("G - Toggle Show Counter Graphs");
         ImGui::Text("H - Toggle Show Help");
         ImGui::Text("0 - Go To Origin");
         ImGui::Text("M - Go To Mark");
+        ImGui::Text("N/B - Next / Prev Event Like Hovered (Shift: All Tracks, ktrace only)");
+        ImGui::Text("R - Mark Next Long Ready Run On Track (Shift: Prev)");
+        ImGui::Text("K - Critical Path To Hovered Event (ktrace only)");
         ImGui::Text(" ");
         ImGui::Text("Ctrl-Drag - Mark / Measure");
         ImGui::Text("Click-Drag - Pan Left / Pan Right");
+        ImGui::Text("Click Track Name - Select Track");
         ImGui::End();
     }
 
+    // Render Wait Queue Window
+    if (show_waitq_window) {
+        WaitQueueView(MAIN_TRACE);
+    }
+
+    // Render Query Window
+    if (show_query_window) {
+        QueryView(MAIN_TRACE);
+    }
+
+    // Render Residency Window
+    if (show_residency_window) {
+        ResidencyView(MAIN_TRACE);
+    }
+
+    // Render Mark Statistics Window
+    if (show_mark_window && (mark0_pos != mark1_pos)) {
+        MarkStatsView(MAIN_TRACE);
+    }
+
+    // Render Diff Window
+    if (diff_mode && show_diff_window) {
+        DiffView();
+    }
+
+    // Render Probes Window
+    if (show_probes_window) {
+        ProbesView(MAIN_TRACE);
+    }
+
+    // Render Critical Path Window
+    if (show_critpath_window) {
+        CriticalPathView();
+    }
+
+    // Render Session Window
+    if (show_session_window) {
+        SessionView();
+    }
+
     // Render Metrics Window
     if (show_metrics_window) {
         ImGui::ShowMetricsWindow(&show_metrics_window);
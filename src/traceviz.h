@@ -6,13 +6,23 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <vector>
 #include <deque>
 #include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "column.h"
 
 int traceviz_main(int argc, char** argv);
 int traceviz_render(void);
+int traceviz_headless(int argc, char** argv);
+
+const char* evtname(uint32_t evt);
 
 #define KTRACE_DEF(num,type,name,group) EVT_##name = num,
 enum {
@@ -34,16 +44,33 @@ namespace tv {
 #define TS_NONE 6
 #define TS_LAST TS_NONE
 
+static inline const char* state_name(unsigned state) {
+    static const char* names[TS_LAST + 1] = {
+        "Suspended",
+        "Ready",
+        "Running",
+        "Blocked",
+        "Sleeping",
+        "Dead",
+        "None",
+    };
+    return (state <= TS_LAST) ? names[state] : "???";
+}
+
 struct Group;
 struct Track;
 struct Event;
 struct TaskState;
+struct Trace;
+struct Reader;
+struct RecordFilter;
 
 struct Group {
     Group* next;
     Track* first;
     Track* last;
     const char* name;
+    uint32_t id;
     uint32_t flags;
 };
 
@@ -76,13 +103,35 @@ static inline bool operator<(const Event& event, int64_t ts) {
 
 struct Track {
     Track* next;
-    std::vector<TaskState> task;
-    std::vector<Event> event;
+    Group* group;
+    Column<TaskState> task;
+    Column<Event> event;
     const char* name;
+    uint32_t id;
     uint16_t idx;
     float y;
 };
 
+// every cpu has a kernel thread named idle<n> that runs whenever the
+// cpu has nothing else to do
+static inline bool is_idle_track(const Track* t) {
+    return !strncmp(t->name, "idle", 4);
+}
+
+// where a merge of many time ordered per-track lists (task states,
+// events, posting lists) has got to in one of them; the earliest comes
+// first out of a std::priority_queue
+struct TrackCursor {
+    int64_t ts;
+    uint16_t trackidx;
+    size_t idx;
+    size_t end;
+
+    bool operator<(const TrackCursor& other) const {
+        return ts > other.ts;
+    }
+};
+
 
 static_assert(sizeof(Event) == 32, "sizeof(Event) != 32");
 
@@ -103,6 +152,7 @@ struct Object {
     uint32_t creator;
 
     Object(uint32_t _id, uint32_t _kind);
+    virtual ~Object() {}
     virtual Thread* as_thread() { return nullptr; }
     virtual Process* as_process() { return nullptr; }
     virtual MsgPipe* as_msgpipe() { return nullptr; }
@@ -140,6 +190,92 @@ struct MsgPipe : public Object {
     virtual MsgPipe* as_msgpipe() { return this; }
 };
 
+struct EventRef {
+    uint16_t trackidx;
+    uint32_t eventidx;
+};
+
+// per-thread tally against a single wait queue
+struct WaitThread {
+    uint16_t trackidx;
+    uint32_t count;
+    int64_t time; // ns blocked (for blockers), unused for wakers
+    uint32_t mutex; // wakes flagged is_mutex (for wakers)
+};
+
+// contention summary for one kernel wait queue
+struct WaitQueue {
+    uint64_t addr;
+    uint32_t blocks;
+    uint32_t unblocks;
+    uint32_t wakes;
+    uint32_t mutex_wakes;
+    int64_t blocked_total;
+    int64_t blocked_max;
+    std::vector<WaitThread> blockers;
+    std::vector<WaitThread> wakers;
+};
+
+// KWAIT_BLOCK/WAKE/UNBLOCK events aggregated by wait queue address,
+// built once after import, ordered hottest (most time blocked) first
+struct WaitQueueIndex {
+    std::vector<WaitQueue> queues;
+    std::unordered_map<uint64_t,uint32_t> lookup;
+
+    void build(Trace& trace);
+    const WaitQueue* find(uint64_t addr) const;
+};
+
+// every event with a given tag, in timestamp order (ts, refs)
+// and grouped by track in event order (by_track)
+struct TagIndex {
+    std::vector<int64_t> ts;
+    std::vector<EventRef> refs;
+    std::vector<EventRef> by_track;
+    std::vector<uint64_t> cum_a; // IPC tags only: sum of a (bytes) over refs[0..k)
+};
+
+// syscalls share their two tags, so they are also indexed by number
+static inline bool is_syscall_tag(uint32_t tag) {
+    return (tag == EVT_SYSCALL_ENTER) || (tag == EVT_SYSCALL_EXIT);
+}
+
+static inline uint64_t syscall_key(uint32_t tag, uint32_t num) {
+    return (((uint64_t) tag) << 32) | num;
+}
+
+static inline bool operator<(const EventRef& a, const EventRef& b) {
+    if (a.trackidx != b.trackidx) {
+        return a.trackidx < b.trackidx;
+    }
+    return a.eventidx < b.eventidx;
+}
+
+static inline bool operator==(const EventRef& a, const EventRef& b) {
+    return (a.trackidx == b.trackidx) && (a.eventidx == b.eventidx);
+}
+
+#define QRY_ARG_A 1
+#define QRY_ARG_B 2
+
+struct Query {
+    int32_t tag;    // -1 matches any tag
+    int64_t t0;     // inclusive
+    int64_t t1;     // exclusive
+    uint32_t args;  // QRY_ARG_* fields that must match
+    uint32_t a;
+    uint32_t b;
+    std::vector<bool> tracks; // by trackidx, empty matches every track
+    size_t limit;
+
+    Query() : tag(-1), t0(-0x7FFFFFFFFFFFFFFFL), t1(0x7FFFFFFFFFFFFFFFL),
+              args(0), a(0), b(0), limit(100000) {}
+};
+
+static inline uint64_t kwait_addr(const Event& evt) {
+    return ((uint64_t)evt.a << 32) | evt.b;
+}
+
 typedef struct evtinfo evt_info_t;
 typedef union ktrace_record ktrace_record_t;
 
@@ -148,6 +284,290 @@ typedef union ktrace_record ktrace_record_t;
 
 #define MAXCPU 32
 
+// time a thread spent in one state on one cpu, as prefix sums over
+// the indices of the track's task states that were in it
+struct ResidencyKey {
+    uint8_t state;
+    uint8_t cpu;
+    std::vector<uint32_t> idx; // ascending task indices
+    std::vector<int64_t> cum;  // cum[k]: total time of idx[0..k)
+};
+
+struct Residency {
+    int64_t time[TS_LAST + 1]; // by TS_* state
+};
+
+struct ResidencyReport {
+    int64_t t0;
+    int64_t t1;
+    std::vector<Residency> threads; // by trackidx
+    std::vector<Residency> groups;  // in group list order
+    Residency cpus[MAXCPU];
+};
+
+// per-track state residency, built once after import, so any time
+// range can be summarized in O(tracks * keys * log n)
+struct ResidencyIndex {
+    std::vector<std::vector<ResidencyKey>> tracks; // by trackidx
+    int64_t tmin;
+    int64_t tmax;
+
+    // on nthreads threads, this one included
+    void build(Trace& trace, unsigned nthreads);
+    void query(Trace& trace, int64_t t0, int64_t t1, ResidencyReport& out);
+};
+
+// A value over time (busy cpus, event rates, ...) summarized as
+// min/max per bucket, with every level twice as coarse as the last
+struct Counter {
+    const char* name;
+    int64_t t0;     // start of bucket 0 at every level
+    int64_t width;  // bucket width at level 0, ns
+    float vmax;     // largest value anywhere
+    std::vector<std::vector<float>> min; // [level][bucket]
+    std::vector<std::vector<float>> max;
+
+    // coarsest level whose buckets are no wider than ns
+    unsigned level_for(int64_t ns) const;
+    // min and max over [t0,t1) at a level, false if there is no data
+    bool range(unsigned level, int64_t t0, int64_t t1, float* lo, float* hi) const;
+    // build the coarser levels and vmax from level 0
+    void build_levels(void);
+};
+
+// log2 buckets of probe span length: bucket n holds [2^n, 2^(n+1)) ns
+#define PROBE_HIST_BUCKETS 40
+
+// a begin/end probe pair and the lengths of all its spans
+struct ProbePair {
+    const char* name;
+    uint32_t begin_tag;
+    uint32_t end_tag;
+    uint32_t count;
+    uint32_t unmatched; // begins without an end and ends without a begin
+    int64_t total;
+    int64_t min;
+    int64_t max;
+    uint32_t hist[PROBE_HIST_BUCKETS];
+};
+
+// one begin to end stretch on a track, nested spans one depth deeper
+struct ProbeSpan {
+    int64_t t0;
+    int64_t t1;
+    uint16_t pair;
+    uint16_t depth;
+};
+
+struct ProbeIndex {
+    std::vector<ProbePair> pairs;
+    std::vector<std::vector<ProbeSpan>> spans; // [trackidx], by t0
+    std::vector<int64_t> longest;              // [trackidx] longest span
+
+    void build(Trace& trace);
+};
+
+// Task states coarsened for drawing zoomed out. A level cuts time into
+// buckets width wide from t0, each taking the state it held longest; an
+// entry starts where that changes and the last one only marks where the
+// track ends.
+struct TaskLodLevel {
+    int64_t width;
+    std::vector<TaskState> runs;
+};
+
+struct TaskLod {
+    int64_t t0;
+    std::vector<std::vector<TaskLodLevel>> levels; // [trackidx], finest first
+
+    // coarsest level of a track whose buckets are no wider than ns, or
+    // -1 when its task states should be drawn as they are
+    int level_for(uint16_t trackidx, double ns) const;
+    void build(Trace& trace);
+};
+
+// the whole trace at a glance for the overview strip: how busy the cpus
+// were and how many events there were in each of OVERVIEW_BUCKETS equal
+// slices of it
+#define OVERVIEW_BUCKETS 1024
+
+struct Overview {
+    int64_t t0;
+    int64_t t1;
+    std::vector<float> busy;      // [bucket] mean cpus running a thread
+    std::vector<uint32_t> events; // [bucket]
+    float busy_max;
+    uint32_t events_max;
+
+    void build(Trace& trace);
+};
+
+// what happened within a marked range, see Trace::mark_stats()
+struct MarkStats {
+    int64_t t0;
+    int64_t t1;
+    std::vector<std::pair<uint32_t,uint32_t>> tags;     // (tag, count), most first
+    std::vector<std::pair<uint32_t,uint32_t>> syscalls; // (number, count), most first
+    uint32_t ipc_writes;
+    uint32_t ipc_reads;
+    uint64_t ipc_write_bytes;
+    uint64_t ipc_read_bytes;
+    std::vector<std::pair<uint16_t,int64_t>> running;   // (trackidx, time), most first
+    ResidencyReport residency;
+};
+
+// a thread matched by name between two traces
+struct DiffThread {
+    const char* name; // "process / thread"
+    int32_t a;        // trackidx in each trace, -1 if only in the other
+    int32_t b;
+    Residency time_a; // over the whole trace
+    Residency time_b;
+};
+
+struct DiffSyscall {
+    const char* name;
+    uint32_t count_a;
+    uint32_t count_b;
+    int64_t mean_a;   // enter to exit, ns
+    int64_t mean_b;
+    int64_t max_a;
+    int64_t max_b;
+};
+
+struct DiffCount {
+    const char* name;
+    uint32_t a;
+    uint32_t b;
+};
+
+// a baseline (a) and a candidate (b) trace lined up by name: threads
+// by process and thread name, syscalls and events by their names
+struct TraceDiff {
+    std::vector<DiffThread> threads;
+    std::vector<DiffSyscall> syscalls;
+    std::vector<DiffCount> events;
+
+    void build(Trace& a, Trace& b);
+};
+
+#define CP_EDGE_NONE 0
+#define CP_EDGE_IPC  1 // channel read of another thread's write
+#define CP_EDGE_WAKE 2 // kwait unblock by another thread's wake
+
+#define CP_MAX_HOPS 256
+
+// one thread's stretch of a critical path: from when it was woken (t0)
+// to when it caused the next hop, or the event the path started from (t1)
+struct CriticalHop {
+    uint16_t trackidx;
+    uint8_t edge;       // how this hop led to the one before it
+    uint8_t cause_edge; // how the hop after this one woke it
+    int64_t t0;
+    int64_t t1;
+    EventRef cause;     // event on this track showing the wakeup, if any
+};
+
+// The chain of threads that kept an event from happening sooner, found
+// by walking back from it over wakeups, channel reads and kwait
+// wakes. step() adds one hop at a time, so the path can be extended a
+// little each frame; hops[0] holds the starting event.
+struct CriticalPath {
+    std::vector<CriticalHop> hops;
+    bool done;
+    uint16_t next_track;
+    int64_t next_ts;
+    uint8_t next_edge;
+
+    CriticalPath() : done(true), next_track(0), next_ts(0), next_edge(CP_EDGE_NONE) {}
+    void start(Trace& trace, const EventRef& from);
+    // returns false once the path is complete
+    bool step(Trace& trace);
+};
+
+// Names (of processes, threads, syscalls, probes) stored once for all
+// the traces of a session, safe to add to from several importing
+// threads. Interned names live as long as the pool.
+struct NamePool {
+    std::mutex lock;
+    std::unordered_set<std::string> names;
+    size_t bytes;
+
+    NamePool() : bytes(0) {}
+    const char* intern(const char* name);
+};
+
+// How begin and end probes pair up into spans: by name pattern, where
+// "*_begin", "*_end" pairs foo_begin with foo_end (a pattern without a
+// '*' is a prefix), or by probe number.
+struct ProbePairRule {
+    const char* begin; // null when pairing by number
+    const char* end;
+    uint32_t begin_num;
+    uint32_t end_num;
+};
+
+#define MAX_PROBE_RULES 8
+#define MAX_FILTER_IDS 16
+
+// the command line options that control importing
+struct ImportOptions {
+    int verbose;
+    unsigned limit;      // bytes of trace to read, 0 for all
+    int show_stats;
+    int two_pass;
+    size_t page_budget;  // bytes of paged track data, 0 for no limit
+    unsigned threads;    // threads building the indexes, 0 for one per core
+    const char* export_path;
+    const char* text_path; // dump records as text here ("-" for stdout)
+    ProbePairRule probe_rules[MAX_PROBE_RULES];
+    unsigned probe_rule_count; // 0 for the default *_begin/*_end rules
+
+    // records to import, by KTRACE_GRP_* group (0 for all), by thread
+    // or process, and by time from the start of the trace (ns, window_t1
+    // 0 for no window); metadata is always kept
+    uint32_t group_mask;
+    uint32_t pids[MAX_FILTER_IDS];
+    unsigned pid_count;
+    uint32_t tids[MAX_FILTER_IDS];
+    unsigned tid_count;
+    int64_t window_t0;
+    int64_t window_t1;
+};
+
+// parse the options in argv[1..], returning the index of the first
+// argument that is not one, or -1 for an unknown option
+int parse_import_options(int argc, char** argv, ImportOptions& opt);
+
+// whether a file starts like something Trace::import() reads: a native
+// file, a compressed trace, or a ktrace version record
+bool is_trace_file(const char* path);
+
+// counts kept while importing, printed by -stats
+struct ImportStats {
+    uint64_t ts_first;
+    uint64_t ts_last;
+    uint32_t events;
+    uint32_t filtered;  // records left out by the import filters
+    uint32_t context_switch;
+    uint32_t msgpipe_new;
+    uint32_t msgpipe_del;
+    uint32_t msgpipe_write;
+    uint32_t msgpipe_read;
+    uint32_t thread_new;
+    uint32_t thread_del;
+    uint32_t process_new;
+    uint32_t process_del;
+    uint64_t count_ns;  // two pass imports only
+    uint64_t import_ns; // reading records, excluding indexes
+};
+
+// what a thread's track will hold, see Trace::count_records()
+struct TrackCount {
+    uint64_t tasks;
+    uint64_t events;
+};
+
 struct Trace {
     std::vector<Track*> tracks;
     std::map<uint32_t,const char*> syscall_names;
@@ -160,10 +580,41 @@ struct Trace {
     Thread* kthread_list;
 
     uint64_t first_timestamp;
+    uint64_t ticks_per_ms;
+    uint32_t version; // from the ktrace version record, 0 without one
+    ImportStats stats;
+
+    WaitQueueIndex waitqs;
+    std::map<uint32_t,TagIndex> tag_index;
+    std::map<uint64_t,TagIndex> syscall_index; // SYSCALL_ENTER/EXIT by syscall_key()
+    ResidencyIndex residency;
+    std::vector<Counter> counters;
+    ProbeIndex probes;
+    TaskLod task_lod;
+    Overview overview;
+
+    // the event column track_add_event() last appended to
+    ColumnBase* unpublished;
+
+    // track sizes by thread key from a counting pass, when importing
+    // in two passes; tids, or kernel thread ids with bit 32 set
+    std::unordered_map<uint64_t,TrackCount> track_counts;
+
+    // set when tracks are paged in from a native file
+    ColumnPager* pager;
+
+    // the thread filter while importing, if there is one
+    RecordFilter* filter;
+
+    ImportOptions options;
+    NamePool* names; // shared with the rest of the session, if any
 
     Track* get_track(unsigned n) {
         return tracks[n];
     }
+    Event* get_event(const EventRef& ref) {
+        return &tracks[ref.trackidx]->event[ref.eventidx];
+    }
     void add_track(Track* track) {
         track->idx = tracks.size();
         tracks.push_back(track);
@@ -171,9 +622,16 @@ struct Trace {
 
     Thread* active[MAXCPU];
 
+    ~Trace();
+
     int import(int argc, char** argv);
+    int import(const char* path);
     int import(int fd);
+    int import_native(int fd);
     void import_event(ktrace_record_t& rec, uint32_t evt);
+    void import_records(Reader* r);
+    uint64_t ticks_to_ts(uint64_t ts);
+    void count_records(Reader* r);
 
     void evt_syscall_name(uint32_t num, const char* name);
     void evt_probe_name(uint32_t num, const char* name);
@@ -213,6 +671,13 @@ struct Trace {
         return group_list;
     }
 
+    const char* source;
+
+    const char* intern(const char* name);
+
+    // bytes of track data and indexes held in memory
+    size_t memory(void);
+
     Object* find_object(uint32_t id, uint32_t kind);
     Process* find_process(uint32_t id, bool create = true);
     Thread* find_thread(uint32_t id, bool create = true);
@@ -223,8 +688,10 @@ struct Trace {
     Group* group_create(void);
     void group_add_track(Group* group, Track* track);
     Track* track_create(void);
+    void track_reserve(Track* t, uint64_t key);
     static void track_append(Track* t, uint64_t ts, uint8_t state, uint8_t cpu);
-    static Event* track_add_event(Track* t, uint64_t ts, uint32_t tag);
+    Event* track_add_event(Track* t, uint64_t ts, uint32_t tag);
+    void publish_pending(void);
 
     const char* syscall_name(uint32_t num) {
         return syscall_names[num];
@@ -233,10 +700,63 @@ struct Trace {
         return probe_names[evt];
     }
 
+    void build_indexes(void);
+    void build_counters(void);
+    void build_tag_index(void);
+    const TagIndex* tag_events(uint32_t tag);
+    const TagIndex* syscall_events(uint32_t tag, uint32_t num);
+    bool query_name(Query& q, const char* name);
+    size_t query(const Query& q, std::vector<EventRef>& out);
+    bool find_adjacent(const EventRef& from, int dir, bool any_track, EventRef& out);
+    void mark_stats(int64_t t0, int64_t t1, MarkStats& out);
+    bool find_ready_run(Track* t, int64_t ts, int dir, int64_t minlen,
+                        int64_t& start, int64_t& end);
+
     void add_object(Object* object);
     void finish(uint64_t ts);
 };
 
+// Traces opened together, sharing one name pool. import() loads each
+// on its own thread, so the whole set takes about as long as the
+// largest trace alone.
+struct Session {
+    NamePool names;
+    std::vector<Trace*> traces;
+
+    // imports on at most one thread per core; traces that fail are
+    // reported and dropped, and their number returned
+    int import(const std::vector<const char*>& paths, const ImportOptions& opt);
+};
+
+};
+
+struct ImDrawList;
+
+// A backend that can draw task state intervals from data it keeps on
+// the GPU registers one of these (see gltracks.cpp), so the timeline
+// only hands it the visible index range of each track.
+struct TrackRenderer {
+    virtual ~TrackRenderer() {}
+    // called once at the start of every frame
+    virtual void frame(void) = 0;
+    // queue the intervals starting at task states [first, last) of t,
+    // in the rectangle (x0, y0) - (x1, y1) with a state at ts placed at
+    // x0 + floor((ts - tsedge) / tscale) and colored by colors[state];
+    // returns false if the track must be drawn the usual way instead
+    virtual bool draw(ImDrawList* dl, tv::Track* t, uint64_t first, uint64_t last,
+                      float x0, float y0, float x1, float y1,
+                      double tsedge, double tscale, const uint32_t* colors) = 0;
+};
+
+void traceviz_set_track_renderer(TrackRenderer* r);
+
+namespace tv {
+
+int export_json(Trace& trace, int fd);
+int export_perfetto(Trace& trace, int fd);
+int export_trace(Trace& trace, const char* path);
+int dump_text(const char* path, const ImportOptions& opt);
+
 };
 
 extern uint8_t font_droid_sans[];
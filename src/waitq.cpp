@@ -0,0 +1,161 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+
+#include "traceviz.h"
+
+namespace tv {
+
+struct WaitWake {
+    int64_t ts;
+    uint16_t trackidx;
+    uint8_t mutex;
+};
+
+static inline bool operator<(int64_t ts, const WaitWake& wake) {
+    return ts < wake.ts;
+}
+
+// per-queue state only needed while building
+struct WaitScratch {
+    std::unordered_map<uint32_t,uint32_t> blocker;
+    std::vector<WaitWake> wakes;
+    std::vector<WaitWake> unblocks;
+};
+
+static WaitThread* tally(std::vector<WaitThread>& list,
+                         std::unordered_map<uint32_t,uint32_t>& slots,
+                         uint16_t trackidx) {
+    auto it = slots.find(trackidx);
+    if (it != slots.end()) {
+        return &list[it->second];
+    }
+    slots[trackidx] = list.size();
+    WaitThread wt;
+    wt.trackidx = trackidx;
+    wt.count = 0;
+    wt.time = 0;
+    wt.mutex = 0;
+    list.push_back(wt);
+    return &list.back();
+}
+
+void WaitQueueIndex::build(Trace& trace) {
+    std::vector<WaitScratch> scratch;
+
+    queues.clear();
+    lookup.clear();
+
+    auto get = [&](uint64_t addr) -> uint32_t {
+        auto it = lookup.find(addr);
+        if (it != lookup.end()) {
+            return it->second;
+        }
+        uint32_t n = queues.size();
+        lookup[addr] = n;
+        queues.push_back(WaitQueue());
+        WaitQueue& q = queues.back();
+        q.addr = addr;
+        q.blocks = q.unblocks = q.wakes = q.mutex_wakes = 0;
+        q.blocked_total = q.blocked_max = 0;
+        scratch.push_back(WaitScratch());
+        return n;
+    };
+
+    // one pass over every event: a thread blocks on at most one
+    // queue at a time, so pair each BLOCK with the next UNBLOCK
+    for (Track* t : trace.tracks) {
+        uint64_t pending = 0;
+        int64_t pending_ts = 0;
+        for (auto& e : t->event) {
+            if ((e.tag < EVT_KWAIT_BLOCK) || (e.tag > EVT_KWAIT_UNBLOCK)) {
+                continue;
+            }
+            uint64_t addr = kwait_addr(e);
+            uint32_t n = get(addr);
+            WaitQueue& q = queues[n];
+            WaitScratch& ws = scratch[n];
+            WaitWake w;
+            w.ts = e.ts;
+            w.trackidx = t->idx;
+            w.mutex = 0;
+            switch (e.tag) {
+            case EVT_KWAIT_BLOCK:
+                q.blocks++;
+                tally(q.blockers, ws.blocker, t->idx)->count++;
+                pending = addr;
+                pending_ts = e.ts;
+                break;
+            case EVT_KWAIT_UNBLOCK:
+                q.unblocks++;
+                if (pending == addr) {
+                    int64_t d = e.ts - pending_ts;
+                    q.blocked_total += d;
+                    if (d > q.blocked_max) {
+                        q.blocked_max = d;
+                    }
+                    tally(q.blockers, ws.blocker, t->idx)->time += d;
+                    pending = 0;
+                }
+                ws.unblocks.push_back(w);
+                break;
+            case EVT_KWAIT_WAKE:
+                q.wakes++;
+                if (e.c) {
+                    q.mutex_wakes++;
+                    w.mutex = 1;
+                }
+                ws.wakes.push_back(w);
+                break;
+            }
+        }
+        column_tick();
+    }
+
+    // attribute each unblock to the most recent wake on the same queue
+    for (unsigned n = 0; n < queues.size(); n++) {
+        WaitQueue& q = queues[n];
+        WaitScratch& ws = scratch[n];
+        std::unordered_map<uint32_t,uint32_t> slots;
+        std::sort(ws.wakes.begin(), ws.wakes.end(),
+                  [](const WaitWake& a, const WaitWake& b) { return a.ts < b.ts; });
+        for (auto& u : ws.unblocks) {
+            auto it = std::upper_bound(ws.wakes.begin(), ws.wakes.end(), u.ts);
+            if (it == ws.wakes.begin()) {
+                continue;
+            }
+            --it;
+            WaitThread* w = tally(q.wakers, slots, it->trackidx);
+            w->count++;
+            w->mutex += it->mutex;
+        }
+        std::sort(q.blockers.begin(), q.blockers.end(),
+                  [](const WaitThread& a, const WaitThread& b) { return a.time > b.time; });
+        std::sort(q.wakers.begin(), q.wakers.end(),
+                  [](const WaitThread& a, const WaitThread& b) { return a.count > b.count; });
+    }
+
+    std::sort(queues.begin(), queues.end(),
+              [](const WaitQueue& a, const WaitQueue& b) {
+                  if (a.blocked_total != b.blocked_total) {
+                      return a.blocked_total > b.blocked_total;
+                  }
+                  return a.blocks > b.blocks;
+              });
+    lookup.clear();
+    for (unsigned n = 0; n < queues.size(); n++) {
+        lookup[queues[n].addr] = n;
+    }
+}
+
+const WaitQueue* WaitQueueIndex::find(uint64_t addr) const {
+    auto it = lookup.find(addr);
+    if (it == lookup.end()) {
+        return nullptr;
+    }
+    return &queues[it->second];
+}
+
+};
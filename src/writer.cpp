@@ -0,0 +1,121 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "writer.h"
+
+namespace tv {
+
+Writer::Writer(int _fd, size_t bufsize) :
+    fd(_fd), buf((char*) malloc(bufsize)), count(0), size(bufsize),
+    written(0), error(buf == nullptr) {
+}
+
+Writer::~Writer() {
+    flush();
+    free(buf);
+}
+
+void Writer::write(const void* data, size_t len) {
+    const char* ptr = (const char*) data;
+    while (len > 0) {
+        if (count == size) {
+            flush();
+        }
+        size_t n = size - count;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buf + count, ptr, n);
+        count += n;
+        ptr += n;
+        len -= n;
+    }
+}
+
+void Writer::puts(const char* str) {
+    write(str, strlen(str));
+}
+
+void Writer::printf(const char* fmt, ...) {
+    char tmp[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        error = true;
+        return;
+    }
+    if ((size_t) n >= sizeof(tmp)) {
+        n = sizeof(tmp) - 1;
+    }
+    write(tmp, n);
+}
+
+void Writer::dec(uint64_t n, unsigned width) {
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+    if (width > sizeof(tmp)) {
+        width = sizeof(tmp);
+    }
+    char* pad = tmp + sizeof(tmp) - width;
+    do {
+        *--p = '0' + (n % 10);
+        n /= 10;
+    } while (n);
+    while (p > pad) {
+        *--p = '0';
+    }
+    write(p, tmp + sizeof(tmp) - p);
+}
+
+void Writer::hex(uint64_t n, unsigned digits) {
+    static const char xdigits[] = "0123456789abcdef";
+    char tmp[16];
+    if (digits > 16) {
+        digits = 16;
+    }
+    for (unsigned i = digits; i > 0; i--) {
+        tmp[i - 1] = xdigits[n & 15];
+        n >>= 4;
+    }
+    write(tmp, digits);
+}
+
+int Writer::flush() {
+    char* ptr = buf;
+    while (count > 0) {
+        ssize_t r = ::write(fd, ptr, count);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = true;
+            count = 0;
+            break;
+        }
+        ptr += r;
+        count -= r;
+        written += r;
+    }
+    return error ? -1 : 0;
+}
+
+int Writer::close() {
+    int r = flush();
+    if ((fd >= 0) && (::close(fd) < 0)) {
+        r = -1;
+    }
+    fd = -1;
+    return r;
+}
+
+};
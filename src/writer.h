@@ -0,0 +1,53 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace tv {
+
+// Buffered output to a file descriptor.
+// Output is accumulated in a fixed size buffer and handed to write(2)
+// in large chunks, so memory use does not grow with the output size.
+// The first write error is latched and reported by flush()/close().
+struct Writer {
+    explicit Writer(int fd, size_t bufsize = 1024 * 1024);
+    ~Writer();
+
+    void write(const void* data, size_t len);
+    void puts(const char* str);
+    void putc(char c) {
+        if (count == size) {
+            flush();
+        }
+        buf[count++] = c;
+    }
+    void printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    // fast integer formatting, avoiding printf for hot paths; dec()
+    // pads with zeros to width digits
+    void dec(uint64_t n, unsigned width = 0);
+    void hex(uint64_t n, unsigned digits);
+
+    int flush();
+    int close();
+
+    uint64_t offset() const {
+        return written + count;
+    }
+
+    int fd;
+    char* buf;
+    size_t count;
+    size_t size;
+    uint64_t written;
+    bool error;
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+};
+
+};